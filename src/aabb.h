@@ -63,6 +63,30 @@ class aabb {
     return true;
   }
 
+  // Slab test with the reciprocal of the ray direction precomputed by the
+  // caller, for traversal loops that test many boxes against one ray.
+  bool hit(const point3& ray_orig, const vec3& inv_dir, interval ray_t) const {
+    for (int axis = 0; axis < 3; ++axis) {
+      const interval& ax = axis_interval(axis);
+      const double t0 = (ax.min - ray_orig[axis]) * inv_dir[axis];
+      const double t1 = (ax.max - ray_orig[axis]) * inv_dir[axis];
+
+      if (t0 < t1) {
+        if (t0 > ray_t.min) ray_t.min = t0;
+        if (t1 < ray_t.max) ray_t.max = t1;
+      } else {
+        if (t1 > ray_t.min) ray_t.min = t1;
+        if (t0 < ray_t.max) ray_t.max = t0;
+      }
+
+      if (ray_t.max <= ray_t.min) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
   int longest_axis() const {
     if (x.size() > y.size()) {
       return x.size() > z.size() ? 0 : 2;
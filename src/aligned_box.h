@@ -0,0 +1,53 @@
+#ifndef _ALIGNED_BOX_H_
+#define _ALIGNED_BOX_H_
+
+#include "arena.h"
+#include "rtweekend.h"
+#include "hittable.h"
+#include "primitive.h"
+
+// Axis aligned box as a single primitive, intersected with one slab test
+// instead of as six quads.
+class aligned_box : public hittable {
+ public:
+  aligned_box(const point3& a, const point3& b, std::shared_ptr<material> mat)
+  : m_data(make_box_data(a, b)), m_mat(mat) {
+    m_bbox = box_bounds(m_data);
+  }
+
+  bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+    if (!hit_box(m_data, r, ray_t, rec)) {
+      return false;
+    }
+
+    rec.mat = m_mat;
+    return true;
+  }
+
+  bool hit_interval(const ray& r, interval& span) const override {
+    return box_interval(m_data, r, span);
+  }
+
+  aabb bounding_box() const override { return m_bbox; }
+
+  const box_data& data() const { return m_data; }
+  const std::shared_ptr<material>& mat() const { return m_mat; }
+
+ private:
+  box_data m_data;
+  std::shared_ptr<material> m_mat;
+  aabb m_bbox;
+};
+
+inline std::shared_ptr<hittable> box(
+  const point3& a, const point3& b, std::shared_ptr<material> mat) {
+  return std::make_shared<aligned_box>(a, b, mat);
+}
+
+inline std::shared_ptr<hittable> box(
+  const point3& a, const point3& b, std::shared_ptr<material> mat,
+  scene_arena& arena) {
+  return arena.make<aligned_box>(a, b, mat);
+}
+
+#endif  // _ALIGNED_BOX_H_
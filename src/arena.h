@@ -0,0 +1,107 @@
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Bump allocator owning every primitive, material and texture of a scene.
+// Objects are placed back to back in large blocks and destroyed all at once
+// with the arena. The handles it returns are shared_ptrs without a control
+// block: they plug into the existing interfaces, but do not own the object
+// and never touch a reference count, so they must not outlive the arena.
+//
+// Constructors that take a color where a texture goes, or build their own
+// children like bvh_node, allocate those on the heap instead. Scenes built
+// here get solid colors from material_registry and use flat_bvh.
+class scene_arena {
+ public:
+  explicit scene_arena(size_t block_size = 64 * 1024)
+  : m_block_size(block_size) {}
+
+  scene_arena(const scene_arena&) = delete;
+  scene_arena& operator=(const scene_arena&) = delete;
+
+  ~scene_arena() { release(); }
+
+  template <typename T, typename... Args>
+  std::shared_ptr<T> make(Args&&... args) {
+    static_assert(alignof(T) <= alignof(std::max_align_t),
+                  "over-aligned types are not supported");
+
+    T* object = new (allocate(sizeof(T), alignof(T)))
+      T(std::forward<Args>(args)...);
+    if (!std::is_trivially_destructible<T>::value) {
+      m_destructors.push_back({ object, &destroy<T> });
+    }
+
+    return std::shared_ptr<T>(std::shared_ptr<T>(), object);
+  }
+
+  // Destroys every object in reverse order of creation and frees the
+  // blocks. Handles given out before are dangling afterwards.
+  void release() {
+    for (auto it = m_destructors.rbegin(); it != m_destructors.rend(); ++it) {
+      it->destroy(it->object);
+    }
+    m_destructors.clear();
+    m_blocks.clear();
+    m_object_count = 0;
+  }
+
+  size_t object_count() const { return m_object_count; }
+
+  size_t bytes_used() const {
+    size_t used = 0;
+    for (const block& b : m_blocks) {
+      used += b.used;
+    }
+    return used;
+  }
+
+ private:
+  struct block {
+    std::unique_ptr<unsigned char[]> data;
+    size_t size;
+    size_t used;
+  };
+
+  struct destructor {
+    void* object;
+    void (*destroy)(void*);
+  };
+
+  size_t                  m_block_size;
+  size_t                  m_object_count = 0;
+  std::vector<block>      m_blocks;
+  std::vector<destructor> m_destructors;
+
+  template <typename T>
+  static void destroy(void* object) {
+    static_cast<T*>(object)->~T();
+  }
+
+  void* allocate(size_t size, size_t alignment) {
+    ++m_object_count;
+
+    if (!m_blocks.empty()) {
+      block& last = m_blocks.back();
+      const size_t offset = (last.used + alignment - 1) & ~(alignment - 1);
+      if (offset + size <= last.size) {
+        last.used = offset + size;
+        return last.data.get() + offset;
+      }
+    }
+
+    const size_t block_size = size > m_block_size ? size : m_block_size;
+    m_blocks.push_back(
+      { std::unique_ptr<unsigned char[]>(new unsigned char[block_size]),
+        block_size, size });
+    return m_blocks.back().data.get();
+  }
+};
+
+#endif  // _ARENA_H_
@@ -0,0 +1,745 @@
+#ifndef _BINARY_SCENE_H_
+#define _BINARY_SCENE_H_
+
+#include "rtweekend.h"
+#include "arena.h"
+#include "camera.h"
+#include "flat_bvh.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "mapped_file.h"
+#include "material.h"
+#include "material_registry.h"
+#include "texture.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <ostream>
+#include <string>
+#include <type_traits>
+#include <typeinfo>
+#include <vector>
+
+// A scene stored in the form flat_bvh traverses, so loading it is mapping
+// the file instead of parsing and building. The file holds:
+//
+//   header      magic, version, byte order, the size of every stored
+//               record type, the camera settings and the tables below
+//   textures    one record each, referenced ones first
+//   materials   type, parameters and texture of each
+//   strings     image file names
+//   trees       per flat_bvh: bounds and the sections of its node,
+//               primitive, primitive bounds, sphere, quad, box, instance and
+//               medium arrays, plus its material and subtree tables. Instanced
+//               and boundary subtrees come before the trees using them, the
+//               root is last.
+//
+// Every section starts on a 64 byte boundary and the arrays are the
+// in-memory structs, so the trees use them in place. The file is therefore
+// only readable on a machine with the same struct layout and byte order,
+// which the header records and load() checks. Textures and materials are
+// few and small, and are rebuilt as objects.
+class binary_scene {
+ public:
+  binary_scene() : m_materials(m_arena) {}
+
+  binary_scene(const binary_scene&) = delete;
+  binary_scene& operator=(const binary_scene&) = delete;
+
+  // Whether path starts like a binary scene file.
+  static bool matches(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    char magic[sizeof(file_magic)];
+    return in.read(magic, sizeof(magic))
+        && std::memcmp(magic, file_magic, sizeof(magic)) == 0;
+  }
+
+  bool load(const std::string& path, std::ostream& err) {
+    if (!m_file.open(path)) {
+      err << "ERROR: Could not map scene file '" << path << "'\n";
+      return false;
+    }
+
+    const char* problem = set_up();
+    if (problem) {
+      err << "ERROR: " << path << ": " << problem << "\n";
+      m_trees.clear();
+      m_file.close();
+      return false;
+    }
+    return true;
+  }
+
+  camera& cam() { return m_camera; }
+  const hittable& world() const { return *m_trees.back(); }
+
+  size_t file_bytes() const { return m_file.size(); }
+  size_t tree_count() const { return m_trees.size(); }
+
+  // Writes world, flattened into one flat_bvh with its subtrees, and the
+  // camera settings to path. Fails for objects the tree keeps as external
+  // hittables, and for materials or textures of other types than the
+  // built in ones.
+  static bool write(
+    const std::string& path,
+    const camera& cam,
+    const hittable& world,
+    std::ostream& err) {
+    // The scenes wrap their tree in a list, which is looked through so the
+    // tree is stored as it is. Anything else is flattened into a new one.
+    const hittable* top = &world;
+    if (typeid(world) == typeid(hittable_list)) {
+      const hittable_list& list = static_cast<const hittable_list&>(world);
+      if (list.objects.size() == 1) {
+        top = list.objects[0].get();
+      }
+    }
+
+    std::shared_ptr<const flat_bvh> root;
+    if (typeid(*top) == typeid(flat_bvh)) {
+      root = std::shared_ptr<const flat_bvh>(
+        std::shared_ptr<const flat_bvh>(), static_cast<const flat_bvh*>(top));
+    } else {
+      const std::shared_ptr<hittable> unowned(
+        std::shared_ptr<hittable>(), const_cast<hittable*>(&world));
+      root = std::make_shared<flat_bvh>(
+        std::vector<std::shared_ptr<hittable>>(1, unowned));
+    }
+
+    writer w;
+    std::string problem;
+    if (!w.add_tree(root.get(), problem)) {
+      err << "ERROR: Cannot write binary scene: " << problem << "\n";
+      return false;
+    }
+
+    std::ofstream out(path, std::ios::binary);
+    w.write(out, cam);
+    if (!out) {
+      err << "ERROR: Could not write scene file '" << path << "'\n";
+      return false;
+    }
+    return true;
+  }
+
+ private:
+  static const uint32_t file_version = 1;
+  static const uint32_t byte_order_mark = 0x01020304u;
+  static const uint64_t alignment = 64;
+  static const uint32_t none = 0xffffffffu;
+  static const char     file_magic[8];
+
+  enum class texture_kind : uint32_t { solid, checker, image, noise };
+
+  struct section {
+    uint64_t offset;
+    uint64_t count;
+  };
+
+  struct camera_record {
+    double  aspect_ratio;
+    double  background[3];
+    double  vfov;
+    double  lookfrom[3];
+    double  lookat[3];
+    double  vup[3];
+    double  defocus_angle;
+    double  focus_dist;
+    int32_t image_width;
+    int32_t samples_per_pixel;
+    int32_t max_depth;
+    int32_t unused;
+  };
+
+  struct file_header {
+    char          magic[8];
+    uint32_t      version;
+    uint32_t      byte_order;
+    uint32_t      record_sizes[8];
+    camera_record view;
+    section       textures;
+    section       materials;
+    section       strings;
+    section       trees;
+  };
+
+  struct texture_record {
+    texture_kind kind;
+    uint32_t     even;
+    uint32_t     odd;
+    uint32_t     seed;
+    uint64_t     name_offset;
+    uint64_t     name_length;
+    double       scale;
+    double       albedo[3];
+  };
+
+  struct material_record {
+    material_type type;
+    uint32_t      texture;
+    double        albedo[3];
+    double        parameter;
+  };
+
+  struct tree_record {
+    aabb    bbox;
+    section nodes;
+    section prims;
+    section prim_bounds;
+    section spheres;
+    section quads;
+    section boxes;
+    section instances;
+    section media;
+    section materials;
+    section subtrees;
+  };
+
+  using tree = flat_bvh;
+
+  static void record_sizes(uint32_t* sizes) {
+    static_assert(std::is_trivially_copyable<tree::node>::value
+                  && std::is_trivially_copyable<quad_data>::value
+                  && std::is_trivially_copyable<instance_data>::value,
+                  "stored records must be plain bytes");
+    sizes[0] = sizeof(tree::node);
+    sizes[1] = sizeof(primitive);
+    sizes[2] = sizeof(aabb);
+    sizes[3] = sizeof(sphere_data);
+    sizes[4] = sizeof(quad_data);
+    sizes[5] = sizeof(box_data);
+    sizes[6] = sizeof(instance_data);
+    sizes[7] = sizeof(medium_data);
+  }
+
+  static uint64_t align_up(uint64_t offset) {
+    return (offset + alignment - 1) / alignment * alignment;
+  }
+
+  // Gathers the trees, materials and textures reachable from a root, each
+  // once, in an order where everything comes after what it references.
+  class writer {
+   public:
+    bool add_tree(const tree* t, std::string& problem) {
+      if (m_tree_ids.count(t)) {
+        return true;
+      }
+
+      if (!t->m_externals.empty()) {
+        const hittable& external = *t->m_externals[0];
+        problem = std::string("the scene holds a ") + typeid(external).name()
+          + ", which is only known through its virtual interface";
+        return false;
+      }
+
+      entry e;
+      e.source = t;
+      for (const std::shared_ptr<flat_bvh>& subtree : t->m_subtrees) {
+        if (!add_tree(subtree.get(), problem)) return false;
+        e.subtrees.push_back(m_tree_ids[subtree.get()]);
+      }
+      for (const std::shared_ptr<material>& mat : t->m_materials) {
+        uint32_t id;
+        if (!add_material(mat.get(), id, problem)) return false;
+        e.materials.push_back(id);
+      }
+
+      m_tree_ids.emplace(t, static_cast<uint32_t>(m_trees.size()));
+      m_trees.push_back(e);
+      return true;
+    }
+
+    void write(std::ostream& out, const camera& cam) {
+      file_header header;
+      std::memset(&header, 0, sizeof(header));
+      std::memcpy(header.magic, file_magic, sizeof(header.magic));
+      header.version = file_version;
+      header.byte_order = byte_order_mark;
+      record_sizes(header.record_sizes);
+      header.view = camera_of(cam);
+
+      // Lay every section out first, then write them in the same order.
+      uint64_t end = sizeof(header);
+      place(end, header.textures, m_textures.size(), sizeof(texture_record));
+      place(end, header.materials, m_materials.size(),
+            sizeof(material_record));
+      place(end, header.strings, m_strings.size(), 1);
+      place(end, header.trees, m_trees.size(), sizeof(tree_record));
+
+      std::vector<tree_record> records(m_trees.size());
+      for (size_t i = 0; i < m_trees.size(); ++i) {
+        const tree::tree_arrays& a = m_trees[i].source->m_arrays;
+        tree_record& r = records[i];
+        r.bbox = m_trees[i].source->m_bbox;
+        place(end, r.nodes, a.nodes.size, sizeof(tree::node));
+        place(end, r.prims, a.prims.size, sizeof(primitive));
+        place(end, r.prim_bounds, a.prim_bounds.size, sizeof(aabb));
+        place(end, r.spheres, a.spheres.size, sizeof(sphere_data));
+        place(end, r.quads, a.quads.size, sizeof(quad_data));
+        place(end, r.boxes, a.boxes.size, sizeof(box_data));
+        place(end, r.instances, a.instances.size, sizeof(instance_data));
+        place(end, r.media, a.media.size, sizeof(medium_data));
+        place(end, r.materials, m_trees[i].materials.size(),
+              sizeof(uint32_t));
+        place(end, r.subtrees, m_trees[i].subtrees.size(), sizeof(uint32_t));
+      }
+
+      uint64_t written = 0;
+      emit(out, written, 0, &header, sizeof(header));
+      emit(out, written, header.textures, m_textures);
+      emit(out, written, header.materials, m_materials);
+      emit(out, written, header.strings.offset, m_strings.data(),
+           m_strings.size());
+      emit(out, written, header.trees, records);
+
+      for (size_t i = 0; i < m_trees.size(); ++i) {
+        const tree::tree_arrays& a = m_trees[i].source->m_arrays;
+        const tree_record& r = records[i];
+        emit(out, written, r.nodes, a.nodes);
+        emit(out, written, r.prims, a.prims);
+        emit(out, written, r.prim_bounds, a.prim_bounds);
+        emit(out, written, r.spheres, a.spheres);
+        emit(out, written, r.quads, a.quads);
+        emit(out, written, r.boxes, a.boxes);
+        emit(out, written, r.instances, a.instances);
+        emit(out, written, r.media, a.media);
+        emit(out, written, r.materials, m_trees[i].materials);
+        emit(out, written, r.subtrees, m_trees[i].subtrees);
+      }
+    }
+
+   private:
+    struct entry {
+      const tree*           source;
+      std::vector<uint32_t> materials;
+      std::vector<uint32_t> subtrees;
+    };
+
+    std::vector<entry>                       m_trees;
+    std::map<const tree*, uint32_t>          m_tree_ids;
+    std::vector<material_record>             m_materials;
+    std::map<const material*, uint32_t>      m_material_ids;
+    std::vector<texture_record>              m_textures;
+    std::map<const texture*, uint32_t>       m_texture_ids;
+    std::string                              m_strings;
+
+    bool add_material(const material* mat, uint32_t& id, std::string& problem) {
+      auto found = m_material_ids.find(mat);
+      if (found != m_material_ids.end()) {
+        id = found->second;
+        return true;
+      }
+
+      material_record r;
+      std::memset(&r, 0, sizeof(r));
+      r.type = mat->type();
+      r.texture = none;
+
+      switch (r.type) {
+        case material_type::lambertian:
+        case material_type::diffuse_light:
+        case material_type::isotropic:
+          if (!add_texture(mat->shading_texture(), r.texture, problem)) {
+            return false;
+          }
+          break;
+        case material_type::metal: {
+          const metal& m = static_cast<const metal&>(*mat);
+          store(m.albedo(), r.albedo);
+          r.parameter = m.fuzz();
+          break;
+        }
+        case material_type::dielectric:
+          r.parameter =
+            static_cast<const dielectric&>(*mat).refraction_index();
+          break;
+        default:
+          problem = std::string("cannot store a material of type ")
+            + typeid(*mat).name();
+          return false;
+      }
+
+      id = static_cast<uint32_t>(m_materials.size());
+      m_material_ids.emplace(mat, id);
+      m_materials.push_back(r);
+      return true;
+    }
+
+    bool add_texture(const texture* tex, uint32_t& id, std::string& problem) {
+      auto found = m_texture_ids.find(tex);
+      if (found != m_texture_ids.end()) {
+        id = found->second;
+        return true;
+      }
+
+      texture_record r;
+      std::memset(&r, 0, sizeof(r));
+      r.even = none;
+      r.odd = none;
+      const std::type_info& type = typeid(*tex);
+
+      if (type == typeid(solid_color)) {
+        r.kind = texture_kind::solid;
+        store(static_cast<const solid_color&>(*tex).albedo(), r.albedo);
+      } else if (type == typeid(checker_texture)) {
+        const checker_texture& c = static_cast<const checker_texture&>(*tex);
+        r.kind = texture_kind::checker;
+        r.scale = c.scale();
+        if (!add_texture(c.even().get(), r.even, problem)
+            || !add_texture(c.odd().get(), r.odd, problem)) {
+          return false;
+        }
+      } else if (type == typeid(image_texture)) {
+        const std::string& name =
+          static_cast<const image_texture&>(*tex).filename();
+        r.kind = texture_kind::image;
+        r.name_offset = m_strings.size();
+        r.name_length = name.size();
+        m_strings += name;
+      } else if (type == typeid(noise_texture)) {
+        // A baked noise volume is a cache and is not stored.
+        const noise_texture& n = static_cast<const noise_texture&>(*tex);
+        r.kind = texture_kind::noise;
+        r.scale = n.scale();
+        r.seed = n.seed();
+      } else {
+        problem = std::string("cannot store a texture of type ") + type.name();
+        return false;
+      }
+
+      id = static_cast<uint32_t>(m_textures.size());
+      m_texture_ids.emplace(tex, id);
+      m_textures.push_back(r);
+      return true;
+    }
+
+    static void store(const vec3& v, double* out) {
+      out[0] = v.x();
+      out[1] = v.y();
+      out[2] = v.z();
+    }
+
+    static camera_record camera_of(const camera& cam) {
+      camera_record r;
+      std::memset(&r, 0, sizeof(r));
+      r.aspect_ratio = cam.aspect_ratio;
+      store(cam.background, r.background);
+      r.vfov = cam.vfov;
+      store(cam.lookfrom, r.lookfrom);
+      store(cam.lookat, r.lookat);
+      store(cam.vup, r.vup);
+      r.defocus_angle = cam.defocus_angle;
+      r.focus_dist = cam.focus_dist;
+      r.image_width = cam.image_width;
+      r.samples_per_pixel = cam.samples_per_pixel;
+      r.max_depth = cam.max_depth;
+      return r;
+    }
+
+    static void place(
+      uint64_t& end, section& s, size_t count, size_t record_size) {
+      s.offset = align_up(end);
+      s.count = count;
+      end = s.offset + count * record_size;
+    }
+
+    // Pads with zeros up to offset, then writes bytes.
+    static void emit(
+      std::ostream& out, uint64_t& written, uint64_t offset,
+      const void* data, size_t bytes) {
+      static const char zeros[alignment] = {};
+      while (written < offset) {
+        const size_t pad = static_cast<size_t>(
+          std::min<uint64_t>(offset - written, alignment));
+        out.write(zeros, pad);
+        written += pad;
+      }
+      out.write(static_cast<const char*>(data), bytes);
+      written += bytes;
+    }
+
+    template <typename T>
+    static void emit(
+      std::ostream& out, uint64_t& written, const section& s,
+      const tree::array_view<T>& a) {
+      emit(out, written, s.offset, a.data, a.size * sizeof(T));
+    }
+
+    template <typename T>
+    static void emit(
+      std::ostream& out, uint64_t& written, const section& s,
+      const std::vector<T>& v) {
+      emit(out, written, s.offset, v.data(), v.size() * sizeof(T));
+    }
+  };
+
+  mapped_file                            m_file;
+  scene_arena                            m_arena;
+  material_registry                      m_materials;
+  camera                                 m_camera;
+  std::vector<std::shared_ptr<flat_bvh>> m_trees;
+
+  template <typename T>
+  const T* at(uint64_t offset) const {
+    return reinterpret_cast<const T*>(m_file.data() + offset);
+  }
+
+  bool fits(const section& s, size_t record_size) const {
+    const uint64_t size = m_file.size();
+    return s.offset % alignment == 0 && s.offset <= size
+        && s.count <= (size - s.offset) / record_size;
+  }
+
+  template <typename T>
+  tree::array_view<T> view(const section& s) const {
+    tree::array_view<T> v;
+    v.data = at<T>(s.offset);
+    v.size = static_cast<size_t>(s.count);
+    return v;
+  }
+
+  static vec3 load_vec3(const double* v) { return vec3(v[0], v[1], v[2]); }
+
+  // Checks that every index in a tree's nodes and primitives is in range
+  // and that traversal stays within its stack, so a damaged file fails to
+  // load instead of being read out of bounds. The nodes of a tree written
+  // by write() come before their children.
+  static const char* check_tree(
+    const tree::tree_arrays& arrays, const tree_record& r) {
+    const size_t node_count = arrays.nodes.size;
+    std::vector<unsigned char> depth(node_count, 0);
+    for (size_t i = 0; i < node_count; ++i) {
+      const tree::node& n = arrays.nodes[i];
+      if (n.count > 0) {
+        if (uint64_t(n.offset) + n.count > arrays.prims.size) {
+          return "bad leaf in tree";
+        }
+        continue;
+      }
+      if (n.axis > 2 || i + 1 >= node_count || n.offset <= i + 1
+          || n.offset >= node_count) {
+        return "bad node in tree";
+      }
+      if (depth[i] + 1 >= tree::max_depth) {
+        return "tree too deep";
+      }
+      depth[i + 1] = std::max<unsigned char>(depth[i + 1], depth[i] + 1);
+      depth[n.offset] =
+        std::max<unsigned char>(depth[n.offset], depth[i] + 1);
+    }
+
+    for (size_t i = 0; i < arrays.prims.size; ++i) {
+      const primitive& p = arrays.prims[i];
+      bool ok = p.type == primitive_type::instance
+        || p.material < r.materials.count;
+      switch (p.type) {
+        case primitive_type::sphere:
+        case primitive_type::moving_sphere:
+          ok = ok && p.index < arrays.spheres.size;
+          break;
+        case primitive_type::quad:
+        case primitive_type::triangle:
+          ok = ok && p.index < arrays.quads.size;
+          break;
+        case primitive_type::box:
+          ok = ok && p.index < arrays.boxes.size;
+          break;
+        case primitive_type::instance:
+          ok = p.index < arrays.instances.size
+            && arrays.instances[p.index].child < r.subtrees.count;
+          break;
+        case primitive_type::medium:
+          ok = ok && p.index < arrays.media.size
+            && arrays.media[p.index].boundary < r.subtrees.count;
+          break;
+        default:
+          ok = false;
+          break;
+      }
+      if (!ok) {
+        return "bad primitive in tree";
+      }
+    }
+    return nullptr;
+  }
+
+  // Checks the tables and builds the scene over the mapping, returning what
+  // is wrong with the file, or null.
+  const char* set_up() {
+    if (m_file.size() < sizeof(file_header)) {
+      return "too short for a scene file";
+    }
+
+    const file_header& header = *at<file_header>(0);
+    uint32_t sizes[8];
+    record_sizes(sizes);
+    if (std::memcmp(header.magic, file_magic, sizeof(header.magic)) != 0) {
+      return "not a binary scene file";
+    }
+    if (header.version != file_version) {
+      return "written by a different version";
+    }
+    if (header.byte_order != byte_order_mark
+        || std::memcmp(header.record_sizes, sizes, sizeof(sizes)) != 0) {
+      return "written on a machine with a different memory layout";
+    }
+    if (!fits(header.textures, sizeof(texture_record))
+        || !fits(header.materials, sizeof(material_record))
+        || !fits(header.strings, 1)
+        || !fits(header.trees, sizeof(tree_record))
+        || header.trees.count == 0) {
+      return "truncated or damaged tables";
+    }
+
+    const camera_record& settings = header.view;
+    m_camera.aspect_ratio = settings.aspect_ratio;
+    m_camera.image_width = settings.image_width;
+    m_camera.samples_per_pixel = settings.samples_per_pixel;
+    m_camera.max_depth = settings.max_depth;
+    m_camera.background = load_vec3(settings.background);
+    m_camera.vfov = settings.vfov;
+    m_camera.lookfrom = load_vec3(settings.lookfrom);
+    m_camera.lookat = load_vec3(settings.lookat);
+    m_camera.vup = load_vec3(settings.vup);
+    m_camera.defocus_angle = settings.defocus_angle;
+    m_camera.focus_dist = settings.focus_dist;
+
+    std::vector<std::shared_ptr<texture>> textures;
+    const texture_record* texture_records =
+      at<texture_record>(header.textures.offset);
+    for (uint64_t i = 0; i < header.textures.count; ++i) {
+      const texture_record& r = texture_records[i];
+      switch (r.kind) {
+        case texture_kind::solid:
+          textures.push_back(m_materials.solid(load_vec3(r.albedo)));
+          break;
+        case texture_kind::checker:
+          if (r.even >= i || r.odd >= i) {
+            return "bad checker texture";
+          }
+          textures.push_back(m_arena.make<checker_texture>(
+            r.scale, textures[r.even], textures[r.odd]));
+          break;
+        case texture_kind::image: {
+          if (r.name_offset > header.strings.count
+              || r.name_length > header.strings.count - r.name_offset) {
+            return "bad image file name";
+          }
+          const std::string name(
+            at<char>(header.strings.offset + r.name_offset),
+            static_cast<size_t>(r.name_length));
+          textures.push_back(m_arena.make<image_texture>(name.c_str()));
+          break;
+        }
+        case texture_kind::noise:
+          textures.push_back(m_arena.make<noise_texture>(r.scale, r.seed));
+          break;
+        default:
+          return "unknown texture kind";
+      }
+    }
+
+    std::vector<std::shared_ptr<material>> materials;
+    const material_record* material_records =
+      at<material_record>(header.materials.offset);
+    for (uint64_t i = 0; i < header.materials.count; ++i) {
+      const material_record& r = material_records[i];
+      const bool textured = r.type == material_type::lambertian
+        || r.type == material_type::diffuse_light
+        || r.type == material_type::isotropic;
+      if (textured && r.texture >= textures.size()) {
+        return "bad material texture";
+      }
+
+      switch (r.type) {
+        case material_type::lambertian:
+          materials.push_back(m_materials.lambertian(textures[r.texture]));
+          break;
+        case material_type::diffuse_light:
+          materials.push_back(
+            m_materials.diffuse_light(textures[r.texture]));
+          break;
+        case material_type::isotropic:
+          materials.push_back(m_materials.isotropic(textures[r.texture]));
+          break;
+        case material_type::metal:
+          materials.push_back(
+            m_materials.metal(load_vec3(r.albedo), r.parameter));
+          break;
+        case material_type::dielectric:
+          materials.push_back(m_materials.dielectric(r.parameter));
+          break;
+        default:
+          return "unknown material type";
+      }
+    }
+
+    const tree_record* tree_records = at<tree_record>(header.trees.offset);
+    for (uint64_t i = 0; i < header.trees.count; ++i) {
+      const tree_record& r = tree_records[i];
+      if (!fits(r.nodes, sizeof(tree::node))
+          || !fits(r.prims, sizeof(primitive))
+          || !fits(r.prim_bounds, sizeof(aabb))
+          || r.prim_bounds.count != r.prims.count
+          || !fits(r.spheres, sizeof(sphere_data))
+          || !fits(r.quads, sizeof(quad_data))
+          || !fits(r.boxes, sizeof(box_data))
+          || !fits(r.instances, sizeof(instance_data))
+          || !fits(r.media, sizeof(medium_data))
+          || !fits(r.materials, sizeof(uint32_t))
+          || !fits(r.subtrees, sizeof(uint32_t))) {
+        return "truncated or damaged tree";
+      }
+
+      std::vector<std::shared_ptr<material>> tree_materials;
+      const uint32_t* material_ids = at<uint32_t>(r.materials.offset);
+      for (uint64_t m = 0; m < r.materials.count; ++m) {
+        if (material_ids[m] >= materials.size()) {
+          return "bad material reference";
+        }
+        tree_materials.push_back(materials[material_ids[m]]);
+      }
+
+      std::vector<std::shared_ptr<flat_bvh>> subtrees;
+      const uint32_t* tree_ids = at<uint32_t>(r.subtrees.offset);
+      for (uint64_t s = 0; s < r.subtrees.count; ++s) {
+        if (tree_ids[s] >= i) {
+          return "bad subtree reference";
+        }
+        subtrees.push_back(m_trees[tree_ids[s]]);
+      }
+
+      tree::tree_arrays arrays;
+      arrays.nodes = view<tree::node>(r.nodes);
+      arrays.prims = view<primitive>(r.prims);
+      arrays.prim_bounds = view<aabb>(r.prim_bounds);
+      arrays.spheres = view<sphere_data>(r.spheres);
+      arrays.quads = view<quad_data>(r.quads);
+      arrays.boxes = view<box_data>(r.boxes);
+      arrays.instances = view<instance_data>(r.instances);
+      arrays.media = view<medium_data>(r.media);
+
+      const char* problem = check_tree(arrays, r);
+      if (problem) {
+        return problem;
+      }
+
+      m_trees.push_back(std::shared_ptr<flat_bvh>(new flat_bvh(
+        arrays, r.bbox, std::move(tree_materials), std::move(subtrees))));
+    }
+
+    return nullptr;
+  }
+};
+
+const uint32_t binary_scene::file_version;
+const uint32_t binary_scene::byte_order_mark;
+const uint64_t binary_scene::alignment;
+const uint32_t binary_scene::none;
+const char     binary_scene::file_magic[8] = {
+  'R', 'T', 'W', 'S', 'C', 'N', 'B', '\0'
+};
+
+#endif  // _BINARY_SCENE_H_
@@ -58,8 +58,34 @@ class bvh_node : public hittable {
     return hit_left || hit_right;
   }
 
+  void hit_packet(
+    ray_packet& packet,
+    unsigned active,
+    hit_record* recs
+  ) const override {
+    if (packet.coherent() && !packet.may_hit(m_bbox, active)) {
+      return;
+    }
+
+    active = packet.hitting(m_bbox, active);
+    if (active == 0u) {
+      return;
+    }
+
+    if (ray_packet::count(active) < ray_packet::min_active) {
+      hittable::hit_packet(packet, active, recs);
+      return;
+    }
+
+    m_left->hit_packet(packet, active, recs);
+    m_right->hit_packet(packet, active, recs);
+  }
+
   aabb bounding_box() const override { return m_bbox; }
 
+  const std::shared_ptr<hittable>& left() const { return m_left; }
+  const std::shared_ptr<hittable>& right() const { return m_right; }
+
  private: 
   std::shared_ptr<hittable> m_left;
   std::shared_ptr<hittable> m_right;
@@ -2,10 +2,26 @@
 #define _CAMERA_H_
 
 #include "rtweekend.h"
+#include "framebuffer.h"
 #include "hittable.h"
 #include "material.h"
+#include "render_state.h"
+#include "timer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
 class camera {
+  friend class wavefront_renderer;
+  friend class distributed_renderer;
+  friend class render_server;
+  friend class preview_renderer;
+
  public:
   double aspect_ratio      = 1.0;
   int    image_width       = 100;
@@ -21,24 +37,47 @@ class camera {
   double defocus_angle     = 0.0;
   double focus_dist        = 10.0;
 
-  void render(const hittable& world) {
+  bool   packet_traversal  = false;
+
+  // Rows are handed out to this many threads, or one per hardware thread
+  // when zero.
+  int          threads       = 1;
+  // Where the image goes, standard output when empty.
+  std::string  output_path;
+  image_format output_format = image_format::ppm;
+
+  // Every pixel gets this many more samples per pass. A pass is the unit
+  // that is checkpointed, and its random numbers depend only on the row and
+  // the pass number.
+  int          samples_per_pass    = 16;
+  // When set, the accumulated state is saved here after the first pass
+  // that ends checkpoint_interval seconds after the previous save.
+  std::string  checkpoint_path;
+  double       checkpoint_interval = 60.0;
+  // Continue from the state in checkpoint_path instead of starting over.
+  bool         resume              = false;
+  // When positive, passes stop once the next one is not expected to finish
+  // within this many seconds of the start of rendering, samples_per_pixel
+  // becoming an upper bound. The first pass always runs and measures the
+  // speed.
+  double       time_budget         = 0.0;
+  // Only the passes whose number modulo share_count is share_index are
+  // rendered, so that separate processes can each take a share.
+  int          share_index         = 0;
+  int          share_count         = 1;
+
+  // Returns false if the checkpoint cannot be resumed or the image cannot
+  // be written.
+  bool render(const hittable& world) {
     initialize();
 
-    std::cout << "P3\n" << image_width << " " << image_height << "\n255\n";
-    for (int y = 0; y < image_height; ++y) {
-      std::clog << "\rScanlines remaining: " << (image_height - y) 
-        << " " << std::flush;
-      for (int x = 0; x < image_width; ++x) {
-        color pixel_color(0.0, 0.0, 0.0);
-        for (int sample = 0; sample < samples_per_pixel; ++sample) {
-          ray r = get_ray(x, y);
-          pixel_color += ray_color(r, max_depth, world);
-        }
-        write_color(std::cout, pixel_color * pixel_samples_scale);
-      }
+    render_state state(image_width, image_height, settings_hash());
+    if (resume && !state.load(checkpoint_path, std::cerr)) {
+      return false;
     }
 
-    std::clog << "\rDone.         \n";
+    render_passes(world, state);
+    return state.resolve().save(output_path, output_format);
   }
 
  private:
@@ -48,12 +87,149 @@ class camera {
   point3 pixel00_loc;
   vec3   pixel_delta_u;
   vec3   pixel_delta_v;
+  double pixel_spread;
   vec3   u;
   vec3   v;
   vec3   w;
   vec3   defocus_disk_u;
   vec3   defocus_disk_v;
 
+  // Renders this camera's share of the passes that state does not have
+  // yet, checkpointing and keeping to the time budget on the way.
+  void render_passes(const hittable& world, render_state& state) {
+    const int passes = pass_count();
+    timer since_start;
+    timer since_checkpoint;
+    int rendered = 0;
+    double last_pass_seconds = 0.0;
+
+    for (int pass = state.passes_done(); pass < passes; ++pass) {
+      if (pass % share_count != share_index) {
+        continue;
+      }
+
+      if (time_budget > 0.0 && rendered > 0) {
+        // The slower of the average and the last pass, so a scene getting
+        // slower as caches fill does not overrun.
+        const double elapsed = since_start.seconds();
+        const double expected =
+          std::max(elapsed / rendered, last_pass_seconds);
+        if (elapsed + expected > time_budget) {
+          if (!checkpoint_path.empty()) {
+            state.save(checkpoint_path, std::cerr);
+          }
+          break;
+        }
+      }
+
+      timer pass_timer;
+      render_pass(pass, passes, world, state);
+      state.set_passes_done(pass + 1);
+      last_pass_seconds = pass_timer.seconds();
+      ++rendered;
+
+      if (!checkpoint_path.empty() && pass + 1 < passes
+          && since_checkpoint.seconds() >= checkpoint_interval) {
+        state.save(checkpoint_path, std::cerr);
+        since_checkpoint.reset();
+      }
+    }
+
+    std::clog << "\rDone.                                   \n";
+    if (time_budget > 0.0) {
+      std::clog << "Rendered " << state.samples(0, 0)
+        << " samples per pixel in " << since_start.seconds() << " s\n";
+    }
+  }
+
+  int thread_count() const {
+    const int available =
+      static_cast<int>(std::thread::hardware_concurrency());
+    const int wanted = threads > 0 ? threads : std::max(available, 1);
+    return std::min(wanted, image_height);
+  }
+
+  int pass_count() const {
+    const int per_pass = std::max(samples_per_pass, 1);
+    return (samples_per_pixel + per_pass - 1) / per_pass;
+  }
+
+  // Everything that changes the image apart from the scene, so a
+  // checkpoint is not resumed with other settings.
+  uint64_t settings_hash() const {
+    const double values[] = {
+      aspect_ratio, background.x(), background.y(), background.z(), vfov,
+      lookfrom.x(), lookfrom.y(), lookfrom.z(), lookat.x(), lookat.y(),
+      lookat.z(), vup.x(), vup.y(), vup.z(), defocus_angle, focus_dist,
+      static_cast<double>(image_width), static_cast<double>(max_depth),
+      static_cast<double>(samples_per_pixel),
+      static_cast<double>(samples_per_pass),
+      packet_traversal ? 1.0 : 0.0
+    };
+
+    uint64_t hash = 0;
+    for (double value : values) {
+      uint64_t bits;
+      std::memcpy(&bits, &value, sizeof(bits));
+      hash = mix_bits(hash ^ bits);
+    }
+    return hash;
+  }
+
+  void render_pass(
+    int pass, int passes, const hittable& world, render_state& state) {
+    std::atomic<int> next_row(0);
+    std::mutex progress;
+    int rows_left = image_height;
+
+    auto render_rows = [&]() {
+      for (int y = next_row++; y < image_height; y = next_row++) {
+        {
+          std::lock_guard<std::mutex> lock(progress);
+          std::clog << "\rPass " << pass + 1 << "/" << passes
+            << ", scanlines remaining: " << rows_left << " " << std::flush;
+          --rows_left;
+        }
+        render_scanline(y, pass, world, state);
+      }
+    };
+
+    std::vector<std::thread> workers;
+    for (int i = 1; i < thread_count(); ++i) {
+      workers.emplace_back(render_rows);
+    }
+    render_rows();
+    for (std::thread& worker : workers) {
+      worker.join();
+    }
+  }
+
+  // Every row of every pass starts from its own seed, so the image does not
+  // depend on which thread renders it, or on whether earlier passes were
+  // rendered by this process.
+  void render_scanline(
+    int y, int pass, const hittable& world, render_state& state) {
+    seed_random(static_cast<uint64_t>(pass) * image_height + y);
+
+    const int per_pass = std::max(samples_per_pass, 1);
+    const int samples =
+      std::min(per_pass, samples_per_pixel - pass * per_pass);
+
+    if (packet_traversal && max_depth > 0) {
+      render_scanline_packets(y, samples, world, state);
+      return;
+    }
+
+    for (int x = 0; x < image_width; ++x) {
+      color pixel_color(0.0, 0.0, 0.0);
+      for (int sample = 0; sample < samples; ++sample) {
+        ray r = get_ray(x, y);
+        pixel_color += ray_color(r, max_depth, world);
+      }
+      state.add(x, y, pixel_color, samples);
+    }
+  }
+
   void initialize() {
     image_height = static_cast<int>(image_width / aspect_ratio);
     image_height = (image_height < 1) ? 1 : image_height;
@@ -77,6 +253,7 @@ class camera {
 
     pixel_delta_u = viewport_u / image_width;
     pixel_delta_v = viewport_v / image_height;
+    pixel_spread = pixel_delta_u.length() / focus_dist;
 
     const point3 viewport_upper_left = center
       - (focus_dist * w) - viewport_u / 2.0 - viewport_v / 2.0;
@@ -100,7 +277,9 @@ class camera {
     const vec3 ray_direction = pixel_sample - ray_origin;
     const double ray_time = random_double();
 
-    return ray(ray_origin, ray_direction, ray_time);
+    ray r(ray_origin, ray_direction, ray_time);
+    r.set_cone(0.0, pixel_spread);
+    return r;
   }
 
   vec3 sample_square() const {
@@ -112,7 +291,39 @@ class camera {
     return center + (p[0] * defocus_disk_u) + (p[1] * defocus_disk_v);
   }
 
-  color ray_color(const ray& r, int depth, const hittable& world) {
+  // Traces primary rays in packets of horizontally adjacent pixels, one
+  // sample per pixel at a time. Only the first hit is found as a packet,
+  // secondary bounces are incoherent and go through ray_color.
+  void render_scanline_packets(
+    int y, int samples, const hittable& world, render_state& state) {
+    for (int x0 = 0; x0 < image_width; x0 += ray_packet::max_size) {
+      const int count = std::min(ray_packet::max_size, image_width - x0);
+      color pixel_colors[ray_packet::max_size];
+
+      for (int sample = 0; sample < samples; ++sample) {
+        ray_packet packet;
+        for (int i = 0; i < count; ++i) {
+          packet.add(get_ray(x0 + i, y), interval(0.001, infinity));
+        }
+        packet.prepare();
+
+        hit_record recs[ray_packet::max_size];
+        world.hit_packet(packet, packet.all(), recs);
+
+        for (int i = 0; i < count; ++i) {
+          pixel_colors[i] += packet.is_active(packet.hit_mask, i)
+            ? shade(packet.rays[i], recs[i], max_depth, world)
+            : background;
+        }
+      }
+
+      for (int i = 0; i < count; ++i) {
+        state.add(x0 + i, y, pixel_colors[i], samples);
+      }
+    }
+  }
+
+  color ray_color(const ray& r, int depth, const hittable& world) const {
     if (depth <= 0) {
       return color(0.0, 0.0, 0.0);
     }
@@ -123,6 +334,14 @@ class camera {
       return background;
     }
 
+    return shade(r, rec, depth, world);
+  }
+
+  color shade(
+    const ray& r,
+    const hit_record& rec,
+    int depth,
+    const hittable& world) const {
     ray scattered;
     color attenuation;
     const color color_from_emission = rec.mat->emitted(rec.u, rec.v, rec.p);
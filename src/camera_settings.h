@@ -0,0 +1,91 @@
+#ifndef _CAMERA_SETTINGS_H_
+#define _CAMERA_SETTINGS_H_
+
+#include "rtweekend.h"
+#include "camera.h"
+
+#include <climits>
+#include <cmath>
+#include <istream>
+#include <string>
+
+// Reads the values of one camera setting from in, leaving whatever
+// follows them. The keys are those of a scene file's camera statement,
+// which also serve render server jobs and preview watch files:
+//
+//   aspect, vfov, defocus_angle, focus_dist     a number
+//   width, spp, depth                           a whole number
+//   background, lookfrom, lookat, vup           three numbers
+//
+// Returns false with a message in error for an unknown key or a bad value.
+inline bool read_camera_setting(
+  const std::string& key, std::istream& in, camera& cam, std::string& error) {
+  auto read_vec3 = [&in](vec3& v) {
+    double x, y, z;
+    if (!(in >> x >> y >> z)) {
+      return false;
+    }
+    v = vec3(x, y, z);
+    return true;
+  };
+
+  // Whole numbers of at least min.
+  auto read_int = [&in](int& v, int min) {
+    double value;
+    if (!(in >> value) || value != std::floor(value) || value < min
+        || value > INT_MAX) {
+      return false;
+    }
+    v = static_cast<int>(value);
+    return true;
+  };
+
+  bool ok;
+  if (key == "background") {
+    ok = read_vec3(cam.background);
+  } else if (key == "lookfrom") {
+    ok = read_vec3(cam.lookfrom);
+  } else if (key == "lookat") {
+    ok = read_vec3(cam.lookat);
+  } else if (key == "vup") {
+    ok = read_vec3(cam.vup);
+  } else if (key == "aspect") {
+    ok = (in >> cam.aspect_ratio) && cam.aspect_ratio > 0.0;
+  } else if (key == "vfov") {
+    ok = static_cast<bool>(in >> cam.vfov);
+  } else if (key == "defocus_angle") {
+    ok = static_cast<bool>(in >> cam.defocus_angle);
+  } else if (key == "focus_dist") {
+    ok = static_cast<bool>(in >> cam.focus_dist);
+  } else if (key == "width") {
+    ok = read_int(cam.image_width, 1);
+  } else if (key == "spp") {
+    ok = read_int(cam.samples_per_pixel, 1);
+  } else if (key == "depth") {
+    ok = read_int(cam.max_depth, 0);
+  } else {
+    error = "unknown setting '" + key + "'";
+    return false;
+  }
+
+  if (!ok) {
+    error = "bad value for '" + key + "'";
+  }
+  return ok;
+}
+
+// A line holding exactly one camera setting.
+inline bool read_camera_setting_line(
+  const std::string& key, std::istream& in, camera& cam, std::string& error) {
+  if (!read_camera_setting(key, in, cam, error)) {
+    return false;
+  }
+  std::string extra;
+  if (in >> extra) {
+    error = "unexpected '" + extra + "' after '" + key + "'";
+    return false;
+  }
+  return true;
+}
+
+#endif  // _CAMERA_SETTINGS_H_
@@ -14,19 +14,17 @@ inline double linear_to_gamma(double linear_component) {
   return 0.0;
 }
 
-inline void write_color(std::ostream& out, const color& pixel_color) {
-  double r = pixel_color.x();
-  double g = pixel_color.y();
-  double b = pixel_color.z();
-
-  r = linear_to_gamma(r);
-  g = linear_to_gamma(g);
-  b = linear_to_gamma(b);
-
+// Gamma corrected 8 bit value of a linear channel, as written to images.
+inline int to_byte(double linear_component) {
   static const interval intensity(0.0, 0.999);
-  int rbyte = static_cast<int>(256 * intensity.clamp(r));
-  int gbyte = static_cast<int>(256 * intensity.clamp(g));
-  int bbyte = static_cast<int>(256 * intensity.clamp(b));
+  return static_cast<int>(
+    256 * intensity.clamp(linear_to_gamma(linear_component)));
+}
+
+inline void write_color(std::ostream& out, const color& pixel_color) {
+  const int rbyte = to_byte(pixel_color.x());
+  const int gbyte = to_byte(pixel_color.y());
+  const int bbyte = to_byte(pixel_color.z());
 
   out << rbyte << " " << gbyte << " " << bbyte << "\n";
 }
@@ -0,0 +1,218 @@
+#ifndef _DISTRIBUTED_H_
+#define _DISTRIBUTED_H_
+
+#include "rtweekend.h"
+#include "camera.h"
+#include "framebuffer.h"
+#include "hittable.h"
+#include "render_state.h"
+#include "timer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+// Splits a render between processes by passes: share i of n renders passes
+// i, i + n, i + 2n and so on. Every pass has its own random numbers, so the
+// shares together take the same samples as a single process would, and
+// the image only differs from a single process render by the rounding of
+// the order the samples are added in.
+//
+// The shares are either forked from this process once the scene is built,
+// sharing it copy-on-write instead of loading it again, and sent back
+// through pipes; or rendered by separate commands that each save their
+// samples to a file, which merge() adds up.
+class distributed_renderer {
+ public:
+  explicit distributed_renderer(camera& cam) : m_cam(cam) {}
+
+  // Renders with this many processes, each using the camera's thread count
+  // or one thread when that is zero. Returns false if a process fails or
+  // the image cannot be written.
+  bool render(const hittable& world, int processes) {
+#ifdef _WIN32
+    (void)world;
+    (void)processes;
+    std::cerr << "ERROR: Rendering with several processes needs fork()\n";
+    return false;
+#else
+    m_cam.initialize();
+    if (m_cam.threads == 0) {
+      m_cam.threads = 1;
+    }
+    split_passes(processes);
+    m_cam.share_count = processes;
+
+    timer render_timer;
+    std::vector<pid_t> children;
+    std::vector<int> pipes;
+
+    // Whatever is buffered would otherwise be written by every child too.
+    std::cout.flush();
+    std::fflush(nullptr);
+
+    for (int i = 0; i < processes; ++i) {
+      int ends[2];
+      if (pipe(ends) != 0) {
+        std::cerr << "ERROR: Could not create a pipe\n";
+        break;
+      }
+
+      const pid_t child = fork();
+      if (child == 0) {
+        for (int fd : pipes) {
+          close(fd);
+        }
+        close(ends[0]);
+        _exit(render_share_to(world, i, ends[1]) ? 0 : 1);
+      }
+
+      close(ends[1]);
+      if (child < 0) {
+        close(ends[0]);
+        std::cerr << "ERROR: Could not start render process\n";
+        break;
+      }
+      children.push_back(child);
+      pipes.push_back(ends[0]);
+    }
+
+    // Shares are added in order, so the image does not depend on which
+    // process finishes first. A child blocks on its pipe until it is read.
+    bool ok = static_cast<int>(children.size()) == processes;
+    render_state total(m_cam.image_width, m_cam.image_height,
+                       m_cam.settings_hash());
+    for (size_t i = 0; i < pipes.size(); ++i) {
+      std::FILE* in = fdopen(pipes[i], "rb");
+      render_state share(m_cam.image_width, m_cam.image_height,
+                         m_cam.settings_hash());
+      if (in && share.read(in, "share " + std::to_string(i + 1),
+                           std::cerr)) {
+        total.merge(share);
+      } else {
+        ok = false;
+      }
+      if (in) {
+        std::fclose(in);
+      } else {
+        close(pipes[i]);
+      }
+    }
+
+    for (pid_t child : children) {
+      int status = 0;
+      if (waitpid(child, &status, 0) != child || !WIFEXITED(status)
+          || WEXITSTATUS(status) != 0) {
+        ok = false;
+      }
+    }
+
+    if (!ok) {
+      std::cerr << "ERROR: A render process failed\n";
+      return false;
+    }
+
+    std::clog << "Rendered with " << processes << " processes in "
+      << render_timer.seconds() << " s\n";
+    return total.resolve().save(m_cam.output_path, m_cam.output_format);
+#endif
+  }
+
+  // Renders share index of count and saves its samples to the camera's
+  // output path, for merge() to add to the others.
+  bool render_share(const hittable& world, int index, int count) {
+    m_cam.initialize();
+    split_passes(count);
+    m_cam.share_index = index;
+    m_cam.share_count = count;
+
+    render_state state(m_cam.image_width, m_cam.image_height,
+                       m_cam.settings_hash());
+    if (m_cam.resume && !state.load(m_cam.checkpoint_path, std::cerr)) {
+      return false;
+    }
+
+    m_cam.render_passes(world, state);
+    return state.save(m_cam.output_path, std::cerr);
+  }
+
+  // Adds up the shares saved in paths, which must all come from the same
+  // scene and settings, and writes the image.
+  static bool merge(
+    const std::vector<std::string>& paths, const std::string& output_path,
+    image_format output_format, std::ostream& err) {
+    render_state total;
+    for (const std::string& path : paths) {
+      render_state share;
+      if (!share.load(path, err)) {
+        return false;
+      }
+      if (&path == &paths.front()) {
+        total = share;
+      } else if (!total.same_settings(share)) {
+        err << "ERROR: '" << path << "' was rendered with other settings"
+          " than '" << paths.front() << "'\n";
+        return false;
+      } else {
+        total.merge(share);
+      }
+    }
+    return total.resolve().save(output_path, output_format);
+  }
+
+ private:
+  camera& m_cam;
+
+  // Sizes the passes so that they deal out evenly: a whole number of them
+  // per share, as close to the camera's pass size as that allows. Only the
+  // last pass can be short, so the shares differ by less than one pass.
+  // Every share of a render makes the same choice.
+  void split_passes(int shares) {
+    const int spp = m_cam.samples_per_pixel;
+    const int per_pass = std::max(m_cam.samples_per_pass, 1);
+    const int rounds = std::max(1, static_cast<int>(std::lround(
+      static_cast<double>(spp) / (static_cast<double>(per_pass) * shares))));
+    const int passes = rounds * shares;
+    const int size = spp / passes + (spp % passes != 0 ? 1 : 0);
+
+    if (size != m_cam.samples_per_pass) {
+      m_cam.samples_per_pass = size;
+      std::clog << "Passes of " << size << " samples per pixel, "
+        << rounds << " per share\n";
+    }
+    if (m_cam.pass_count() < shares) {
+      std::clog << "WARNING: Only " << m_cam.pass_count() << " of the "
+        << shares << " shares have samples to render\n";
+    }
+  }
+
+#ifndef _WIN32
+  // Runs in a forked child. Only the first share reports its progress, the
+  // others would overwrite it on the same line.
+  bool render_share_to(const hittable& world, int index, int fd) {
+    if (index > 0) {
+      std::clog.rdbuf(nullptr);
+    }
+    m_cam.share_index = index;
+
+    render_state state(m_cam.image_width, m_cam.image_height,
+                       m_cam.settings_hash());
+    m_cam.render_passes(world, state);
+
+    std::FILE* out = fdopen(fd, "wb");
+    const bool written = out && state.write(out);
+    return out && std::fclose(out) == 0 && written;
+  }
+#endif
+};
+
+#endif  // _DISTRIBUTED_H_
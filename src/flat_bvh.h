@@ -0,0 +1,635 @@
+#ifndef _FLAT_BVH_H_
+#define _FLAT_BVH_H_
+
+#include "rtweekend.h"
+
+#include "aabb.h"
+#include "aligned_box.h"
+#include "bvh.h"
+#include "constant_medium.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "primitive.h"
+#include "quad.h"
+#include "sphere.h"
+#include "triangle.h"
+
+#include <algorithm>
+#include <typeinfo>
+#include <unordered_map>
+#include <vector>
+
+// BVH stored as a flat array of nodes whose leaves hold primitives by value.
+// Spheres, quads, triangles, boxes, translate/rotate_y instances and constant
+// media are converted to their plain data form and intersected through a
+// switch, so a traversal makes no virtual calls for them. Nested flat_bvh
+// trees are merged. Any other hittable is kept as an external primitive and
+// called through its usual interface.
+//
+// Traversal reads the arrays through plain pointers, so a tree can also use
+// them in place from a mapped scene file (see binary_scene.h).
+class flat_bvh final : public hittable {
+  friend class binary_scene;
+
+ public:
+  static const uint32_t max_leaf_size = 2;
+
+  explicit flat_bvh(const hittable_list& list) : flat_bvh(list.objects) {}
+
+  explicit flat_bvh(const std::vector<std::shared_ptr<hittable>>& objects) {
+    build_state state;
+    for (const std::shared_ptr<hittable>& object : objects) {
+      collect(object, state);
+    }
+    build(state.items);
+  }
+
+  // Builds the tree straight from box corners sharing one material, without
+  // creating a hittable per box first.
+  flat_bvh(const std::vector<box_data>& boxes, std::shared_ptr<material> mat) {
+    build_state state;
+    const uint32_t material = material_index(mat, state);
+    m_boxes.reserve(boxes.size());
+    state.items.reserve(boxes.size());
+    for (const box_data& b : boxes) {
+      add_item(primitive_type::box, static_cast<uint32_t>(m_boxes.size()),
+               material, box_bounds(b), state);
+      m_boxes.push_back(b);
+    }
+    build(state.items);
+  }
+
+  bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+    if (m_arrays.nodes.size == 0) {
+      return false;
+    }
+
+    const vec3& d = r.direction();
+    return traverse(0, r, vec3(1.0 / d[0], 1.0 / d[1], 1.0 / d[2]), ray_t, rec);
+  }
+
+  void hit_packet(
+    ray_packet& packet,
+    unsigned active,
+    hit_record* recs
+  ) const override {
+    if (m_arrays.nodes.size == 0) {
+      return;
+    }
+
+    struct entry { uint32_t node; unsigned mask; };
+    entry stack[max_depth];
+    int top = 0;
+    stack[top++] = { 0u, active };
+
+    while (top > 0) {
+      const entry current = stack[--top];
+      const node& n = m_arrays.nodes[current.node];
+
+      if (packet.coherent() && !packet.may_hit(n.bbox, current.mask)) {
+        continue;
+      }
+
+      const unsigned mask = packet.hitting(n.bbox, current.mask);
+      if (mask == 0u) {
+        continue;
+      }
+
+      if (ray_packet::count(mask) < ray_packet::min_active) {
+        for (int i = 0; i < packet.size; ++i) {
+          if (packet.is_active(mask, i)
+              && traverse(current.node, packet.rays[i], packet.inv_dir(i),
+                          packet.ray_t[i], recs[i])) {
+            packet.ray_t[i].max = recs[i].t;
+            packet.hit_mask |= 1u << i;
+          }
+        }
+        continue;
+      }
+
+      if (n.count > 0) {
+        for (uint32_t p = n.offset; p < n.offset + n.count; ++p) {
+          for (int i = 0; i < packet.size; ++i) {
+            if (packet.is_active(mask, i)
+                && hit_primitive(m_arrays.prims[p], packet.rays[i],
+                                 packet.ray_t[i], recs[i])) {
+              packet.ray_t[i].max = recs[i].t;
+              packet.hit_mask |= 1u << i;
+            }
+          }
+        }
+        continue;
+      }
+
+      // Visit the near child first, judged by the first live ray.
+      int lead = 0;
+      while (!packet.is_active(mask, lead)) {
+        ++lead;
+      }
+      if (packet.rays[lead].direction()[n.axis] < 0.0) {
+        stack[top++] = { current.node + 1, mask };
+        stack[top++] = { n.offset, mask };
+      } else {
+        stack[top++] = { n.offset, mask };
+        stack[top++] = { current.node + 1, mask };
+      }
+    }
+  }
+
+  // Medium boundaries are single-object subtrees, which get the interval
+  // straight from the primitive's kernel.
+  bool hit_interval(const ray& r, interval& span) const override {
+    if (m_arrays.prims.size != 1) {
+      return hittable::hit_interval(r, span);
+    }
+
+    const primitive& prim = m_arrays.prims[0];
+    switch (prim.type) {
+      case primitive_type::sphere:
+        return sphere_interval(
+          m_arrays.spheres[prim.index], false, r, span);
+      case primitive_type::moving_sphere:
+        return sphere_interval(
+          m_arrays.spheres[prim.index], true, r, span);
+      case primitive_type::box:
+        return box_interval(m_arrays.boxes[prim.index], r, span);
+      case primitive_type::instance: {
+        const instance_data& inst = m_arrays.instances[prim.index];
+        return m_subtrees[inst.child]->hit_interval(
+          instance_ray(inst, r), span);
+      }
+      case primitive_type::external:
+        return m_externals[prim.index]->hit_interval(r, span);
+      default:
+        return hittable::hit_interval(r, span);
+    }
+  }
+
+  aabb bounding_box() const override { return m_bbox; }
+
+  size_t node_count() const { return m_arrays.nodes.size; }
+  size_t primitive_count() const { return m_arrays.prims.size; }
+
+ private:
+  // Interior nodes store their second child at offset, the first child
+  // follows the node directly. Leaves store count primitives from offset.
+  struct node {
+    aabb     bbox;
+    uint32_t offset;
+    uint32_t count;
+    uint32_t axis;
+  };
+
+  // A read-only array, either one of the vectors below or a section of a
+  // mapped file.
+  template <typename T>
+  struct array_view {
+    const T* data = nullptr;
+    size_t   size = 0;
+
+    const T& operator[](size_t i) const { return data[i]; }
+  };
+
+  struct tree_arrays {
+    array_view<node>          nodes;
+    array_view<primitive>     prims;
+    array_view<aabb>          prim_bounds;
+    array_view<sphere_data>   spheres;
+    array_view<quad_data>     quads;
+    array_view<box_data>      boxes;
+    array_view<instance_data> instances;
+    array_view<medium_data>   media;
+  };
+
+  struct build_item {
+    primitive prim;
+    aabb      bbox;
+  };
+
+  struct build_state {
+    std::vector<build_item>                      items;
+    std::unordered_map<const material*, uint32_t> materials;
+    std::unordered_map<const hittable*, uint32_t> subtrees;
+  };
+
+  // Traversal stacks hold one entry per level. Median splits of up to
+  // 2^32 items stay within half of it, and items are only split off above
+  // the other half.
+  static const int max_depth = 64;
+  static const int max_split_off_depth = max_depth / 2;
+  static const uint32_t no_material = 0xffffffffu;
+
+  std::vector<node>                      m_nodes;
+  std::vector<primitive>                 m_prims;
+  std::vector<aabb>                      m_prim_bounds;
+  std::vector<sphere_data>               m_spheres;
+  std::vector<quad_data>                 m_quads;
+  std::vector<box_data>                  m_boxes;
+  std::vector<instance_data>             m_instances;
+  std::vector<medium_data>               m_media;
+  std::vector<std::shared_ptr<material>> m_materials;
+  std::vector<std::shared_ptr<flat_bvh>> m_subtrees;
+  std::vector<std::shared_ptr<hittable>> m_externals;
+  aabb                                   m_bbox;
+  tree_arrays                            m_arrays;
+
+  // A tree whose arrays live elsewhere and outlive it.
+  flat_bvh(
+    const tree_arrays& arrays,
+    const aabb& bbox,
+    std::vector<std::shared_ptr<material>> materials,
+    std::vector<std::shared_ptr<flat_bvh>> subtrees)
+  : m_materials(std::move(materials))
+  , m_subtrees(std::move(subtrees))
+  , m_bbox(bbox)
+  , m_arrays(arrays) {}
+
+  template <typename T>
+  static array_view<T> view_of(const std::vector<T>& v) {
+    array_view<T> view;
+    view.data = v.data();
+    view.size = v.size();
+    return view;
+  }
+
+  bool traverse(
+    uint32_t root,
+    const ray& r,
+    const vec3& inv_dir,
+    interval ray_t,
+    hit_record& rec) const {
+    const bool dir_negative[3] = {
+      r.direction()[0] < 0.0, r.direction()[1] < 0.0, r.direction()[2] < 0.0
+    };
+
+    uint32_t stack[max_depth];
+    int top = 0;
+    uint32_t current = root;
+    bool hit_anything = false;
+
+    while (true) {
+      const node& n = m_arrays.nodes[current];
+
+      if (n.bbox.hit(r.origin(), inv_dir, ray_t)) {
+        if (n.count > 0) {
+          for (uint32_t p = n.offset; p < n.offset + n.count; ++p) {
+            if (hit_primitive(m_arrays.prims[p], r, ray_t, rec)) {
+              hit_anything = true;
+              ray_t.max = rec.t;
+            }
+          }
+        } else if (dir_negative[n.axis]) {
+          stack[top++] = current + 1;
+          current = n.offset;
+          continue;
+        } else {
+          stack[top++] = n.offset;
+          current = current + 1;
+          continue;
+        }
+      }
+
+      if (top == 0) {
+        break;
+      }
+      current = stack[--top];
+    }
+
+    return hit_anything;
+  }
+
+  bool hit_primitive(
+    const primitive& prim,
+    const ray& r,
+    interval ray_t,
+    hit_record& rec) const {
+    switch (prim.type) {
+      case primitive_type::sphere:
+        if (!hit_sphere(
+              m_arrays.spheres[prim.index], false, r, ray_t, rec)) {
+          return false;
+        }
+        break;
+      case primitive_type::moving_sphere:
+        if (!hit_sphere(
+              m_arrays.spheres[prim.index], true, r, ray_t, rec)) {
+          return false;
+        }
+        break;
+      case primitive_type::quad:
+        if (!hit_quad(m_arrays.quads[prim.index], r, ray_t, rec)) {
+          return false;
+        }
+        break;
+      case primitive_type::triangle:
+        if (!hit_triangle(m_arrays.quads[prim.index], r, ray_t, rec)) {
+          return false;
+        }
+        break;
+      case primitive_type::box:
+        if (!hit_box(m_arrays.boxes[prim.index], r, ray_t, rec)) {
+          return false;
+        }
+        break;
+      case primitive_type::instance: {
+        const instance_data& inst = m_arrays.instances[prim.index];
+        return hit_instance(inst, *m_subtrees[inst.child], r, ray_t, rec);
+      }
+      case primitive_type::medium: {
+        const medium_data& medium = m_arrays.media[prim.index];
+        if (!hit_medium(*m_subtrees[medium.boundary], medium.neg_inv_density,
+                        r, ray_t, rec)) {
+          return false;
+        }
+        break;
+      }
+      default:
+        return m_externals[prim.index]->hit(r, ray_t, rec);
+    }
+
+    rec.mat = m_materials[prim.material];
+    return true;
+  }
+
+  uint32_t material_index(
+    const std::shared_ptr<material>& mat,
+    build_state& state) {
+    auto found = state.materials.find(mat.get());
+    if (found != state.materials.end()) {
+      return found->second;
+    }
+    const uint32_t index = static_cast<uint32_t>(m_materials.size());
+    m_materials.push_back(mat);
+    state.materials.emplace(mat.get(), index);
+    return index;
+  }
+
+  // Instanced objects and medium boundaries become flat subtrees of their
+  // own, shared between every primitive that references the same object.
+  uint32_t subtree_index(
+    const std::shared_ptr<hittable>& object,
+    build_state& state) {
+    auto found = state.subtrees.find(object.get());
+    if (found != state.subtrees.end()) {
+      return found->second;
+    }
+
+    std::shared_ptr<flat_bvh> subtree =
+      std::dynamic_pointer_cast<flat_bvh>(object);
+    if (!subtree) {
+      subtree = std::make_shared<flat_bvh>(
+        std::vector<std::shared_ptr<hittable>>(1, object));
+    }
+
+    const uint32_t index = static_cast<uint32_t>(m_subtrees.size());
+    m_subtrees.push_back(subtree);
+    state.subtrees.emplace(object.get(), index);
+    return index;
+  }
+
+  void add_item(
+    primitive_type type,
+    uint32_t index,
+    uint32_t material,
+    const aabb& bbox,
+    build_state& state) {
+    state.items.push_back({ { type, index, material }, bbox });
+  }
+
+  void add_instance(
+    const std::shared_ptr<hittable>& child,
+    const vec3& offset,
+    double sin_theta,
+    double cos_theta,
+    const aabb& bbox,
+    build_state& state) {
+    const uint32_t index = static_cast<uint32_t>(m_instances.size());
+    m_instances.push_back(
+      { offset, sin_theta, cos_theta, subtree_index(child, state) });
+    add_item(primitive_type::instance, index, no_material, bbox, state);
+  }
+
+  // Matches on the exact type, so user subclasses (for example a quad with
+  // its own is_interior) keep their virtual behaviour as externals.
+  void collect(const std::shared_ptr<hittable>& object, build_state& state) {
+    const hittable& obj = *object;
+    const std::type_info& type = typeid(obj);
+
+    if (type == typeid(hittable_list)) {
+      for (const std::shared_ptr<hittable>& child :
+           static_cast<const hittable_list&>(obj).objects) {
+        collect(child, state);
+      }
+    } else if (type == typeid(bvh_node)) {
+      const bvh_node& bvh = static_cast<const bvh_node&>(obj);
+      collect(bvh.left(), state);
+      if (bvh.right() != bvh.left()) {
+        collect(bvh.right(), state);
+      }
+    } else if (type == typeid(sphere)) {
+      const sphere& s = static_cast<const sphere&>(obj);
+      const uint32_t index = static_cast<uint32_t>(m_spheres.size());
+      m_spheres.push_back(s.data());
+      add_item(
+        s.is_moving() ? primitive_type::moving_sphere : primitive_type::sphere,
+        index, material_index(s.mat(), state), s.bounding_box(), state);
+    } else if (type == typeid(quad)) {
+      const quad& q = static_cast<const quad&>(obj);
+      const uint32_t index = static_cast<uint32_t>(m_quads.size());
+      m_quads.push_back(q.data());
+      add_item(primitive_type::quad, index, material_index(q.mat(), state),
+               q.bounding_box(), state);
+    } else if (type == typeid(triangle)) {
+      const triangle& tri = static_cast<const triangle&>(obj);
+      const uint32_t index = static_cast<uint32_t>(m_quads.size());
+      m_quads.push_back(tri.data());
+      add_item(primitive_type::triangle, index,
+               material_index(tri.mat(), state), tri.bounding_box(), state);
+    } else if (type == typeid(aligned_box)) {
+      const aligned_box& b = static_cast<const aligned_box&>(obj);
+      const uint32_t index = static_cast<uint32_t>(m_boxes.size());
+      m_boxes.push_back(b.data());
+      add_item(primitive_type::box, index, material_index(b.mat(), state),
+               b.bounding_box(), state);
+    } else if (type == typeid(flat_bvh)) {
+      merge(static_cast<const flat_bvh&>(obj), state);
+    } else if (type == typeid(translate)) {
+      const translate& t = static_cast<const translate&>(obj);
+      const hittable& inner = *t.object();
+      if (typeid(inner) == typeid(rotate_y)) {
+        const rotate_y& rot = static_cast<const rotate_y&>(inner);
+        add_instance(rot.object(), t.offset(), rot.sin_theta(),
+                     rot.cos_theta(), t.bounding_box(), state);
+      } else {
+        add_instance(t.object(), t.offset(), 0.0, 1.0, t.bounding_box(),
+                     state);
+      }
+    } else if (type == typeid(rotate_y)) {
+      const rotate_y& rot = static_cast<const rotate_y&>(obj);
+      add_instance(rot.object(), vec3(0.0, 0.0, 0.0), rot.sin_theta(),
+                   rot.cos_theta(), rot.bounding_box(), state);
+    } else if (type == typeid(constant_medium)) {
+      const constant_medium& medium = static_cast<const constant_medium&>(obj);
+      const uint32_t index = static_cast<uint32_t>(m_media.size());
+      m_media.push_back(
+        { medium.neg_inv_density(), subtree_index(medium.boundary(), state) });
+      add_item(primitive_type::medium, index,
+               material_index(medium.phase_function(), state),
+               medium.bounding_box(), state);
+    } else {
+      const uint32_t index = static_cast<uint32_t>(m_externals.size());
+      m_externals.push_back(object);
+      add_item(primitive_type::external, index, no_material,
+               obj.bounding_box(), state);
+    }
+  }
+
+  // Takes over the primitives of another tree, so nested trees are rebuilt
+  // as one instead of being traversed through a virtual call.
+  void merge(const flat_bvh& other, build_state& state) {
+    for (size_t i = 0; i < other.m_arrays.prims.size; ++i) {
+      const primitive& prim = other.m_arrays.prims[i];
+      uint32_t index = 0;
+
+      switch (prim.type) {
+        case primitive_type::sphere:
+        case primitive_type::moving_sphere:
+          index = static_cast<uint32_t>(m_spheres.size());
+          m_spheres.push_back(other.m_arrays.spheres[prim.index]);
+          break;
+        case primitive_type::quad:
+        case primitive_type::triangle:
+          index = static_cast<uint32_t>(m_quads.size());
+          m_quads.push_back(other.m_arrays.quads[prim.index]);
+          break;
+        case primitive_type::box:
+          index = static_cast<uint32_t>(m_boxes.size());
+          m_boxes.push_back(other.m_arrays.boxes[prim.index]);
+          break;
+        case primitive_type::instance: {
+          instance_data inst = other.m_arrays.instances[prim.index];
+          inst.child = subtree_index(other.m_subtrees[inst.child], state);
+          index = static_cast<uint32_t>(m_instances.size());
+          m_instances.push_back(inst);
+          break;
+        }
+        case primitive_type::medium: {
+          medium_data medium = other.m_arrays.media[prim.index];
+          medium.boundary =
+            subtree_index(other.m_subtrees[medium.boundary], state);
+          index = static_cast<uint32_t>(m_media.size());
+          m_media.push_back(medium);
+          break;
+        }
+        default:
+          index = static_cast<uint32_t>(m_externals.size());
+          m_externals.push_back(other.m_externals[prim.index]);
+          break;
+      }
+
+      const uint32_t material = prim.material == no_material
+        ? no_material
+        : material_index(other.m_materials[prim.material], state);
+      add_item(prim.type, index, material, other.m_arrays.prim_bounds[i],
+               state);
+    }
+  }
+
+  void build(std::vector<build_item>& items) {
+    m_bbox = aabb::empty;
+    for (const build_item& item : items) {
+      m_bbox = aabb(m_bbox, item.bbox);
+    }
+
+    m_prims.reserve(items.size());
+    m_prim_bounds.reserve(items.size());
+    m_nodes.reserve(2 * items.size());
+    if (!items.empty()) {
+      build_node(items, 0, items.size(), 0);
+    }
+
+    m_arrays.nodes = view_of(m_nodes);
+    m_arrays.prims = view_of(m_prims);
+    m_arrays.prim_bounds = view_of(m_prim_bounds);
+    m_arrays.spheres = view_of(m_spheres);
+    m_arrays.quads = view_of(m_quads);
+    m_arrays.boxes = view_of(m_boxes);
+    m_arrays.instances = view_of(m_instances);
+    m_arrays.media = view_of(m_media);
+  }
+
+  static double surface_area(const aabb& box) {
+    const double dx = box.x.size();
+    const double dy = box.y.size();
+    const double dz = box.z.size();
+    return 2.0 * (dx * dy + dy * dz + dz * dx);
+  }
+
+  // Same split as bvh_node: sort along the longest axis of the node bounds
+  // and cut at the median.
+  uint32_t build_node(
+    std::vector<build_item>& items,
+    size_t start,
+    size_t end,
+    int depth) {
+    const uint32_t index = static_cast<uint32_t>(m_nodes.size());
+    m_nodes.push_back(node());
+
+    aabb bbox = aabb::empty;
+    for (size_t i = start; i < end; ++i) {
+      bbox = aabb(bbox, items[i].bbox);
+    }
+
+    const size_t span = end - start;
+    if (span <= max_leaf_size) {
+      m_nodes[index] = {
+        bbox, static_cast<uint32_t>(m_prims.size()),
+        static_cast<uint32_t>(span), 0u
+      };
+      for (size_t i = start; i < end; ++i) {
+        m_prims.push_back(items[i].prim);
+        m_prim_bounds.push_back(items[i].bbox);
+      }
+      return index;
+    }
+
+    // An item nearly as large as the whole node (an enclosing fog volume,
+    // a ground plane) would widen every node on its path down the tree, so
+    // it is split off on its own right below this node instead. Nested
+    // shells would make a chain of these as long as the item count, so
+    // deep down the tree they are left to the median split.
+    size_t largest = start;
+    for (size_t i = start + 1; i < end; ++i) {
+      if (surface_area(items[i].bbox) > surface_area(items[largest].bbox)) {
+        largest = i;
+      }
+    }
+    if (depth < max_split_off_depth
+        && surface_area(items[largest].bbox) > 0.5 * surface_area(bbox)) {
+      std::swap(items[start], items[largest]);
+      build_node(items, start, start + 1, depth + 1);
+      const uint32_t rest = build_node(items, start + 1, end, depth + 1);
+      m_nodes[index] = { bbox, rest, 0u, 0u };
+      return index;
+    }
+
+    const int axis = bbox.longest_axis();
+    std::sort(items.begin() + start, items.begin() + end,
+      [axis](const build_item& a, const build_item& b) {
+        return a.bbox.axis_interval(axis).min < b.bbox.axis_interval(axis).min;
+      });
+
+    const size_t mid = start + span / 2;
+    build_node(items, start, mid, depth + 1);
+    const uint32_t second = build_node(items, mid, end, depth + 1);
+    m_nodes[index] = { bbox, second, 0u, static_cast<uint32_t>(axis) };
+    return index;
+  }
+};
+
+const uint32_t flat_bvh::max_leaf_size;
+const int flat_bvh::max_depth;
+const int flat_bvh::max_split_off_depth;
+const uint32_t flat_bvh::no_material;
+
+#endif  // _FLAT_BVH_H_
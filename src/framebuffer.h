@@ -0,0 +1,130 @@
+#ifndef _FRAMEBUFFER_H_
+#define _FRAMEBUFFER_H_
+
+#include "rtweekend.h"
+
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+enum class image_format {
+  // Plain text P3, the format this renderer has always written.
+  ppm,
+  // Binary P6, same gamma corrected bytes at a fraction of the size.
+  ppm_binary,
+  // Portable float map of the linear radiance, without gamma or clamping.
+  pfm
+};
+
+inline bool parse_image_format(const std::string& name, image_format& format) {
+  if (name == "ppm") {
+    format = image_format::ppm;
+  } else if (name == "ppm-binary") {
+    format = image_format::ppm_binary;
+  } else if (name == "pfm") {
+    format = image_format::pfm;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// Final pixel colors of a render, row by row from the top, written out in
+// one go once every row is done.
+class framebuffer {
+ public:
+  framebuffer(int width, int height)
+  : m_width(width), m_height(height)
+  , m_pixels(static_cast<size_t>(width) * height) {}
+
+  int width() const { return m_width; }
+  int height() const { return m_height; }
+
+  color& at(int x, int y) {
+    return m_pixels[static_cast<size_t>(y) * m_width + x];
+  }
+
+  const color& at(int x, int y) const {
+    return m_pixels[static_cast<size_t>(y) * m_width + x];
+  }
+
+  void write(std::ostream& out, image_format format) const {
+    switch (format) {
+      case image_format::ppm:
+        out << "P3\n" << m_width << " " << m_height << "\n255\n";
+        for (const color& pixel : m_pixels) {
+          write_color(out, pixel);
+        }
+        break;
+      case image_format::ppm_binary:
+        write_binary_ppm(out);
+        break;
+      case image_format::pfm:
+        write_pfm(out);
+        break;
+    }
+  }
+
+  // Writes to path, or to standard output when path is empty. Returns false
+  // if the file cannot be written.
+  bool save(const std::string& path, image_format format) const {
+    if (path.empty()) {
+      write(std::cout, format);
+      return static_cast<bool>(std::cout.flush());
+    }
+
+    std::ofstream out(path, std::ios::binary);
+    write(out, format);
+    if (!out) {
+      std::cerr << "ERROR: Could not write image file '" << path << "'\n";
+      return false;
+    }
+    return true;
+  }
+
+ private:
+  int                m_width;
+  int                m_height;
+  std::vector<color> m_pixels;
+
+  void write_binary_ppm(std::ostream& out) const {
+    out << "P6\n" << m_width << " " << m_height << "\n255\n";
+
+    std::vector<char> row(static_cast<size_t>(m_width) * 3);
+    for (int y = 0; y < m_height; ++y) {
+      for (int x = 0; x < m_width; ++x) {
+        const color& pixel = at(x, y);
+        for (int c = 0; c < 3; ++c) {
+          row[3 * x + c] = static_cast<char>(to_byte(pixel[c]));
+        }
+      }
+      out.write(row.data(), row.size());
+    }
+  }
+
+  // Rows go bottom to top, and the negative scale marks little endian.
+  void write_pfm(std::ostream& out) const {
+    const uint16_t probe = 1;
+    unsigned char first_byte;
+    std::memcpy(&first_byte, &probe, 1);
+    const bool little_endian = first_byte == 1;
+
+    out << "PF\n" << m_width << " " << m_height << "\n"
+        << (little_endian ? "-1.0" : "1.0") << "\n";
+
+    std::vector<float> row(static_cast<size_t>(m_width) * 3);
+    for (int y = m_height - 1; y >= 0; --y) {
+      for (int x = 0; x < m_width; ++x) {
+        const color& pixel = at(x, y);
+        for (int c = 0; c < 3; ++c) {
+          row[3 * x + c] = static_cast<float>(pixel[c]);
+        }
+      }
+      out.write(reinterpret_cast<const char*>(row.data()),
+                row.size() * sizeof(float));
+    }
+  }
+};
+
+#endif  // _FRAMEBUFFER_H_
@@ -0,0 +1,315 @@
+#ifndef _GRID_MEDIUM_H_
+#define _GRID_MEDIUM_H_
+
+#include "rtweekend.h"
+#include "aabb.h"
+#include "hittable.h"
+#include "material.h"
+#include "perlin.h"
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Voxel densities on a regular grid, sampled with trilinear interpolation
+// between voxel centers. Besides the voxels the grid keeps a coarse grid of
+// majorants, the largest density reachable inside each block of voxels, so
+// tracking can take long steps through thin regions and skip empty ones.
+class density_grid {
+ public:
+  // Edge length of a majorant block, in voxels.
+  static const int block_size = 8;
+
+  density_grid() {}
+
+  density_grid(int nx, int ny, int nz)
+  : m_nx(nx), m_ny(ny), m_nz(nz)
+  , m_voxels(static_cast<size_t>(nx) * ny * nz, 0.0f) {}
+
+  // Reads nx * ny * nz native-endian 32 bit floats, x varying fastest.
+  // Returns false with error set if the file is missing or too short.
+  static bool load_raw(
+    const std::string& filename, int nx, int ny, int nz, density_grid& grid,
+    std::string& error) {
+    std::ifstream in(filename, std::ios::binary);
+    if (!in) {
+      error = "could not open voxel file '" + filename + "'";
+      return false;
+    }
+
+    density_grid loaded(nx, ny, nz);
+    in.read(reinterpret_cast<char*>(loaded.m_voxels.data()),
+            loaded.m_voxels.size() * sizeof(float));
+    if (!in) {
+      error = "voxel file '" + filename + "' is shorter than "
+        + std::to_string(loaded.m_voxels.size()) + " floats";
+      return false;
+    }
+
+    loaded.build_majorants();
+    grid = std::move(loaded);
+    return true;
+  }
+
+  // Positive half of Perlin noise sampled at scale * voxel position in the
+  // unit cube, so about half of the volume is empty.
+  static density_grid from_perlin(
+    int nx, int ny, int nz, double scale,
+    uint32_t seed = perlin::default_seed) {
+    density_grid grid(nx, ny, nz);
+    const perlin noise(seed);
+    std::vector<point3> row(nx);
+    std::vector<double> values(nx);
+
+    for (int z = 0; z < nz; ++z) {
+      for (int y = 0; y < ny; ++y) {
+        for (int x = 0; x < nx; ++x) {
+          row[x] = scale * point3(
+            (x + 0.5) / nx, (y + 0.5) / ny, (z + 0.5) / nz);
+        }
+        noise.noise(row.data(), values.data(), row.size());
+        for (int x = 0; x < nx; ++x) {
+          grid.voxel(x, y, z) = static_cast<float>(fmax(0.0, values[x]));
+        }
+      }
+    }
+
+    grid.build_majorants();
+    return grid;
+  }
+
+  bool empty() const { return m_voxels.empty(); }
+
+  int resolution(int axis) const {
+    return axis == 0 ? m_nx : (axis == 1 ? m_ny : m_nz);
+  }
+
+  int block_count(int axis) const { return m_blocks[axis]; }
+
+  float majorant(int bx, int by, int bz) const {
+    return m_majorants[
+      (static_cast<size_t>(bz) * m_blocks[1] + by) * m_blocks[0] + bx];
+  }
+
+  // Density at a point given in grid units, [0, 1] along every axis.
+  double sample(const point3& p) const {
+    const double x = p.x() * m_nx - 0.5;
+    const double y = p.y() * m_ny - 0.5;
+    const double z = p.z() * m_nz - 0.5;
+
+    const int x0 = static_cast<int>(floor(x));
+    const int y0 = static_cast<int>(floor(y));
+    const int z0 = static_cast<int>(floor(z));
+    const double fx = x - x0;
+    const double fy = y - y0;
+    const double fz = z - z0;
+
+    double accum = 0.0;
+    for (int i = 0; i < 2; ++i) {
+      for (int j = 0; j < 2; ++j) {
+        for (int k = 0; k < 2; ++k) {
+          accum += (i ? fx : 1.0 - fx)
+                 * (j ? fy : 1.0 - fy)
+                 * (k ? fz : 1.0 - fz)
+                 * clamped_voxel(x0 + i, y0 + j, z0 + k);
+        }
+      }
+    }
+
+    return accum;
+  }
+
+ private:
+  int                m_nx = 0;
+  int                m_ny = 0;
+  int                m_nz = 0;
+  int                m_blocks[3] = { 0, 0, 0 };
+  std::vector<float> m_voxels;
+  std::vector<float> m_majorants;
+
+  float& voxel(int x, int y, int z) {
+    return m_voxels[(static_cast<size_t>(z) * m_ny + y) * m_nx + x];
+  }
+
+  float clamped_voxel(int x, int y, int z) const {
+    x = std::min(std::max(x, 0), m_nx - 1);
+    y = std::min(std::max(y, 0), m_ny - 1);
+    z = std::min(std::max(z, 0), m_nz - 1);
+    return m_voxels[(static_cast<size_t>(z) * m_ny + y) * m_nx + x];
+  }
+
+  // A lookup inside a block interpolates voxels up to one past its edges,
+  // so those are included in the block's maximum.
+  void build_majorants() {
+    const int dims[3] = { m_nx, m_ny, m_nz };
+    for (int axis = 0; axis < 3; ++axis) {
+      m_blocks[axis] = (dims[axis] + block_size - 1) / block_size;
+    }
+    m_majorants.assign(
+      static_cast<size_t>(m_blocks[0]) * m_blocks[1] * m_blocks[2], 0.0f);
+
+    for (int bz = 0; bz < m_blocks[2]; ++bz) {
+      for (int by = 0; by < m_blocks[1]; ++by) {
+        for (int bx = 0; bx < m_blocks[0]; ++bx) {
+          float max_density = 0.0f;
+          const int x0 = bx * block_size;
+          const int y0 = by * block_size;
+          const int z0 = bz * block_size;
+          for (int z = z0 - 1; z <= z0 + block_size; ++z) {
+            for (int y = y0 - 1; y <= y0 + block_size; ++y) {
+              for (int x = x0 - 1; x <= x0 + block_size; ++x) {
+                max_density = std::max(max_density, clamped_voxel(x, y, z));
+              }
+            }
+          }
+          m_majorants[(static_cast<size_t>(bz) * m_blocks[1] + by)
+                      * m_blocks[0] + bx] = max_density;
+        }
+      }
+    }
+  }
+};
+
+const int density_grid::block_size;
+
+// Participating medium with spatially varying density, filling an axis
+// aligned box. Scattering distances are sampled with delta tracking: the
+// ray walks the majorant blocks it crosses, draws tentative collisions
+// against each block's majorant and accepts one with probability
+// density / majorant. Blocks whose majorant is zero are stepped over
+// without drawing any random numbers.
+class grid_medium : public hittable {
+ public:
+  grid_medium(
+    const aabb& bounds,
+    std::shared_ptr<density_grid> grid,
+    double density,
+    std::shared_ptr<material> phase_function)
+  : m_bounds(bounds)
+  , m_grid(grid)
+  , m_density(density)
+  , m_phase_function(phase_function) {}
+
+  grid_medium(
+    const aabb& bounds,
+    std::shared_ptr<density_grid> grid,
+    double density,
+    const color& albedo)
+  : grid_medium(bounds, grid, density, std::make_shared<isotropic>(albedo)) {}
+
+  bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+    if (m_grid->empty()) {
+      return false;
+    }
+
+    // Ray in grid units, where the box spans the unit cube.
+    const vec3 inv_extent(1.0 / m_bounds.x.size(),
+                          1.0 / m_bounds.y.size(),
+                          1.0 / m_bounds.z.size());
+    const point3 lo(m_bounds.x.min, m_bounds.y.min, m_bounds.z.min);
+    const point3 origin = (r.origin() - lo) * inv_extent;
+    const vec3 direction = r.direction() * inv_extent;
+
+    double t_enter = ray_t.min;
+    double t_exit = ray_t.max;
+    for (int axis = 0; axis < 3; ++axis) {
+      const double inv = 1.0 / direction[axis];
+      double t0 = -origin[axis] * inv;
+      double t1 = (1.0 - origin[axis]) * inv;
+      if (t0 > t1) {
+        std::swap(t0, t1);
+      }
+      t_enter = fmax(t_enter, t0);
+      t_exit = fmin(t_exit, t1);
+    }
+    if (t_exit <= t_enter) {
+      return false;
+    }
+
+    // 3D DDA over the majorant blocks. The last block along an axis may
+    // reach past the box when the resolution is not a multiple of its size.
+    int block[3];
+    int step[3];
+    double t_next[3];
+    double t_delta[3];
+    const point3 start = origin + t_enter * direction;
+    for (int axis = 0; axis < 3; ++axis) {
+      const int blocks = m_grid->block_count(axis);
+      const double scale = m_grid->resolution(axis)
+        / static_cast<double>(density_grid::block_size);
+      const double cell = start[axis] * scale;
+      block[axis] = std::min(std::max(static_cast<int>(cell), 0), blocks - 1);
+
+      const double d = direction[axis] * scale;
+      if (d > 0.0) {
+        step[axis] = 1;
+        t_delta[axis] = 1.0 / d;
+        t_next[axis] = t_enter + (block[axis] + 1 - cell) / d;
+      } else if (d < 0.0) {
+        step[axis] = -1;
+        t_delta[axis] = -1.0 / d;
+        t_next[axis] = t_enter + (block[axis] - cell) / d;
+      } else {
+        step[axis] = 0;
+        t_delta[axis] = infinity;
+        t_next[axis] = infinity;
+      }
+    }
+
+    const double ray_length = r.direction().length();
+    double t = t_enter;
+
+    while (true) {
+      const int axis = t_next[0] < t_next[1]
+        ? (t_next[0] < t_next[2] ? 0 : 2)
+        : (t_next[1] < t_next[2] ? 1 : 2);
+      const double t_block_exit = fmin(t_next[axis], t_exit);
+
+      const double majorant =
+        m_density * m_grid->majorant(block[0], block[1], block[2]);
+      if (majorant > 0.0) {
+        while (true) {
+          t -= log(1.0 - random_double()) / (majorant * ray_length);
+          if (t >= t_block_exit) {
+            break;
+          }
+
+          const double density =
+            m_density * m_grid->sample(origin + t * direction);
+          if (random_double() * majorant < density) {
+            rec.t = t;
+            rec.p = r.at(t);
+            rec.normal = vec3(1.0, 0.0, 0.0);
+            rec.front_face = true;
+            rec.footprint = 0.0;
+            rec.mat = m_phase_function;
+            return true;
+          }
+        }
+      }
+
+      if (t_block_exit >= t_exit) {
+        return false;
+      }
+
+      t = t_block_exit;
+      block[axis] += step[axis];
+      if (block[axis] < 0 || block[axis] >= m_grid->block_count(axis)) {
+        return false;
+      }
+      t_next[axis] += t_delta[axis];
+    }
+  }
+
+  aabb bounding_box() const override { return m_bounds; }
+
+ private:
+  aabb                          m_bounds;
+  std::shared_ptr<density_grid> m_grid;
+  double                        m_density;
+  std::shared_ptr<material>     m_phase_function;
+};
+
+#endif  // _GRID_MEDIUM_H_
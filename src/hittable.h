@@ -3,6 +3,7 @@
 
 #include "rtweekend.h"
 #include "aabb.h"
+#include "ray_packet.h"
 
 class material;
 
@@ -15,11 +16,29 @@ class hit_record {
   double u;
   double v;
   bool front_face;
+  // Width of the ray cone's footprint at the hit in uv units, 0 for a
+  // point sample.
+  double footprint = 0.0;
 
   void set_face_normal(const ray& r, const vec3& outward_normal) {
     front_face = dot(r.direction(), outward_normal) < 0.0;
     normal = front_face ? outward_normal : -outward_normal;
   }
+
+  // Projects the ray cone onto the surface at t, given how many uv units
+  // one unit of distance on the surface spans. Call after the normal is
+  // set. Grazing angles are capped so the footprint stays finite.
+  void set_footprint(const ray& r, double uv_per_unit) {
+    const double width = r.width_at(t);
+    if (width <= 0.0) {
+      footprint = 0.0;
+      return;
+    }
+
+    const double cos_theta =
+      fabs(dot(r.direction(), normal)) / r.direction().length();
+    footprint = width * uv_per_unit / fmax(cos_theta, 0.1);
+  }
 };
 
 class hittable {
@@ -33,6 +52,42 @@ class hittable {
   ) const = 0;
 
   virtual aabb bounding_box() const = 0;
+
+  // Intersects the active rays of a packet, narrowing each ray's interval
+  // and setting its bit in packet.hit_mask on a hit. The default falls back
+  // to one hit() call per ray.
+  virtual void hit_packet(
+    ray_packet& packet,
+    unsigned active,
+    hit_record* recs
+  ) const {
+    for (int i = 0; i < packet.size; ++i) {
+      if (packet.is_active(active, i)
+          && hit(packet.rays[i], packet.ray_t[i], recs[i])) {
+        packet.ray_t[i].max = recs[i].t;
+        packet.hit_mask |= 1u << i;
+      }
+    }
+  }
+
+  // Distances at which the ray's line enters and leaves the object, for
+  // closed convex objects such as medium boundaries. Only t is computed,
+  // no hit attributes. The default finds the first hit anywhere on the
+  // line and the next one after it.
+  virtual bool hit_interval(const ray& r, interval& span) const {
+    hit_record rec1, rec2;
+
+    if (!hit(r, interval::universe, rec1)) {
+      return false;
+    }
+
+    if (!hit(r, interval(rec1.t + 0.0001, infinity), rec2)) {
+      return false;
+    }
+
+    span = interval(rec1.t, rec2.t);
+    return true;
+  }
 };
 
 class translate : public hittable {
@@ -44,6 +99,7 @@ class translate : public hittable {
 
   bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
     ray offset_r(r.origin() - m_offset, r.direction(), r.time());
+    offset_r.set_cone(r.cone_width(), r.cone_spread());
 
     if (!m_object->hit(offset_r, ray_t, rec)) {
       return false;
@@ -53,8 +109,16 @@ class translate : public hittable {
     return true;
   };
 
+  bool hit_interval(const ray& r, interval& span) const override {
+    return m_object->hit_interval(
+      ray(r.origin() - m_offset, r.direction(), r.time()), span);
+  }
+
   aabb bounding_box() const override { return m_bbox; }
 
+  const std::shared_ptr<hittable>& object() const { return m_object; }
+  const vec3& offset() const { return m_offset; }
+
  private:
   std::shared_ptr<hittable> m_object;
   vec3 m_offset;
@@ -97,20 +161,7 @@ class rotate_y : public hittable {
   }
 
   bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
-    point3 origin = r.origin();
-    vec3 direction = r.direction();
-
-    origin[0] = m_cos_theta * r.origin()[0] - m_sin_theta * r.origin()[2];
-    origin[2] = m_sin_theta * r.origin()[0] + m_cos_theta * r.origin()[2];
-
-    direction[0] =
-      m_cos_theta * r.direction()[0] - m_sin_theta * r.direction()[2];
-    direction[2] =
-      m_sin_theta * r.direction()[0] + m_cos_theta * r.direction()[2];
-
-    const ray rotated_r(origin, direction, r.time());
-
-    if (!m_object->hit(rotated_r, ray_t, rec)) {
+    if (!m_object->hit(rotated(r), ray_t, rec)) {
       return false;
     }
 
@@ -128,13 +179,40 @@ class rotate_y : public hittable {
     return true;
   }
 
+  // The rotation keeps distances along the ray, so the child's interval
+  // holds for the original ray as well.
+  bool hit_interval(const ray& r, interval& span) const override {
+    return m_object->hit_interval(rotated(r), span);
+  }
+
   aabb bounding_box() const override { return m_bbox; }
 
+  const std::shared_ptr<hittable>& object() const { return m_object; }
+  double sin_theta() const { return m_sin_theta; }
+  double cos_theta() const { return m_cos_theta; }
+
  private:
   std::shared_ptr<hittable> m_object;
   double m_sin_theta;
   double m_cos_theta;
   aabb m_bbox;
+
+  ray rotated(const ray& r) const {
+    point3 origin = r.origin();
+    vec3 direction = r.direction();
+
+    origin[0] = m_cos_theta * r.origin()[0] - m_sin_theta * r.origin()[2];
+    origin[2] = m_sin_theta * r.origin()[0] + m_cos_theta * r.origin()[2];
+
+    direction[0] =
+      m_cos_theta * r.direction()[0] - m_sin_theta * r.direction()[2];
+    direction[2] =
+      m_sin_theta * r.direction()[0] + m_cos_theta * r.direction()[2];
+
+    ray rotated_r(origin, direction, r.time());
+    rotated_r.set_cone(r.cone_width(), r.cone_spread());
+    return rotated_r;
+  }
 };
 
 #endif  // _HITTABLE_H_
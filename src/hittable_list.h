@@ -40,6 +40,17 @@ class hittable_list : public hittable {
 
     return hit_anything;
   }
+
+  void hit_packet(
+    ray_packet& packet,
+    unsigned active,
+    hit_record* recs
+  ) const override {
+    for (const std::shared_ptr<hittable>& object : objects) {
+      object->hit_packet(packet, active, recs);
+    }
+  }
+
   aabb bounding_box() const override { return bbox; }
 
  private:
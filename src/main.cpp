@@ -1,26 +1,40 @@
 // CC0 (raytracing.github.io) 2024 - Copy by Meerkat
 
-#include "bvh.h"
+#include "aligned_box.h"
+#include "arena.h"
+#include "binary_scene.h"
 #include "constant_medium.h"
+#include "flat_bvh.h"
+#include "grid_medium.h"
 #include "rtweekend.h"
 
 #include "camera.h"
 #include "hittable.h"
 #include "hittable_list.h"
 #include "material.h"
+#include "material_registry.h"
+#include "perlin_bench.h"
 #include "sphere.h"
 #include "quad.h"
+#include "render_options.h"
+#include "scene_file.h"
 #include "texture.h"
+#include "texture_cache.h"
+#include "timer.h"
+
+void bouncing_spheres(const render_options& options) {
+  scene_arena arena;
+  material_registry materials(arena);
 
-void bouncing_spheres() {
   hittable_list world;
 
   const std::shared_ptr<texture> checker = 
-    std::make_shared<checker_texture>(
-      0.32, color(0.2, 0.3, 0.1), color(0.9, 0.9, 0.9));
-  const std::shared_ptr<lambertian> ground_material =
-    std::make_shared<lambertian>(checker);
-  world.add(std::make_shared<sphere>(
+    arena.make<checker_texture>(
+      0.32, materials.solid(color(0.2, 0.3, 0.1)),
+      materials.solid(color(0.9, 0.9, 0.9)));
+  const std::shared_ptr<material> ground_material =
+    materials.lambertian(checker);
+  world.add(arena.make<sphere>(
     point3(0.0, -1000.0, 0.0), 1000, ground_material));
 
   for (int a = -11; a < 11; ++a) {
@@ -34,20 +48,20 @@ void bouncing_spheres() {
 
         if (choose_mat < 0.8) {
           const color albedo = color::random() * color::random();
-          sphere_material = std::make_shared<lambertian>(albedo);
+          sphere_material = materials.lambertian(albedo);
           const point3 center2 = 
             center + vec3(0.0, random_double(0.0, 0.5), 0.0);
-          world.add(std::make_shared<sphere>(
+          world.add(arena.make<sphere>(
                     center, center2, 0.2, sphere_material));
         } else if (choose_mat < 0.95) {
           const color albedo = color::random(0.5, 1.0);
           const double fuzz = random_double(0.0, 0.5);
-          sphere_material = std::make_shared<metal>(albedo, fuzz);
-          world.add(std::make_shared<sphere>(
+          sphere_material = materials.metal(albedo, fuzz);
+          world.add(arena.make<sphere>(
                     center, 0.2, sphere_material));
         } else {
-          sphere_material = std::make_shared<dielectric>(1.5);
-          world.add(std::make_shared<sphere>(
+          sphere_material = materials.dielectric(1.5);
+          world.add(arena.make<sphere>(
                     center, 0.2, sphere_material));
         }
       }
@@ -55,19 +69,19 @@ void bouncing_spheres() {
   }
 
   const std::shared_ptr<material> material1 = 
-    std::make_shared<dielectric>(1.5);
-  world.add(std::make_shared<sphere>(
+    materials.dielectric(1.5);
+  world.add(arena.make<sphere>(
     point3(0.0, 1.0, 0.0), 1.0, material1));
   const std::shared_ptr<material> material2 = 
-    std::make_shared<lambertian>(color(0.4, 0.2, 0.1));
-  world.add(std::make_shared<sphere>(
+    materials.lambertian(color(0.4, 0.2, 0.1));
+  world.add(arena.make<sphere>(
     point3(-4.0, 1.0, 0.0), 1.0, material2));
   const std::shared_ptr<material> material3 = 
-    std::make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
-  world.add(std::make_shared<sphere>(
+    materials.metal(color(0.7, 0.6, 0.5), 0.0);
+  world.add(arena.make<sphere>(
     point3(4.0, 1.0, 0.0), 1.0, material3));
 
-  world = hittable_list(std::make_shared<bvh_node>(world));
+  world = hittable_list(arena.make<flat_bvh>(world));
 
   camera cam;
 
@@ -85,20 +99,24 @@ void bouncing_spheres() {
   cam.defocus_angle = 0.6;
   cam.focus_dist = 10.0;
 
-  cam.render(world);
+  options.render(cam, world);
 }
 
-void checkered_spheres() {
+void checkered_spheres(const render_options& options) {
+  scene_arena arena;
+  material_registry materials(arena);
+
   hittable_list world;
 
   const std::shared_ptr<texture> checker =
-    std::make_shared<checker_texture>(
-      0.32, color(0.2, 0.3, 0.1), color(0.9, 0.9, 0.9));
+    arena.make<checker_texture>(
+      0.32, materials.solid(color(0.2, 0.3, 0.1)),
+      materials.solid(color(0.9, 0.9, 0.9)));
 
-  world.add(std::make_shared<sphere>(point3(0.0, -10.0, 0.0), 10.0,
-            std::make_shared<lambertian>(checker)));
-  world.add(std::make_shared<sphere>(point3(0.0, 10.0, 0.0), 10.0,
-            std::make_shared<lambertian>(checker)));
+  world.add(arena.make<sphere>(point3(0.0, -10.0, 0.0), 10.0,
+            materials.lambertian(checker)));
+  world.add(arena.make<sphere>(point3(0.0, 10.0, 0.0), 10.0,
+            materials.lambertian(checker)));
 
   camera cam;
 
@@ -115,16 +133,19 @@ void checkered_spheres() {
 
   cam.defocus_angle = 0.0;
 
-  cam.render(world);
+  options.render(cam, world);
 }
 
-void earth() {
+void earth(const render_options& options) {
+  scene_arena arena;
+  material_registry materials(arena);
+
   const std::shared_ptr<texture> earth_texture =
-    std::make_shared<image_texture>("earthmap.jpg");
+    arena.make<image_texture>("earthmap.jpg");
   const std::shared_ptr<material> earth_surface = 
-    std::make_shared<lambertian>(earth_texture);
+    materials.lambertian(earth_texture);
   const std::shared_ptr<hittable> globe = 
-    std::make_shared<sphere>(point3(0.0, 0.0, 0.0), 2.0, earth_surface);
+    arena.make<sphere>(point3(0.0, 0.0, 0.0), 2.0, earth_surface);
 
   camera cam;
   
@@ -141,19 +162,22 @@ void earth() {
 
   cam.defocus_angle = 0.0;
 
-  cam.render(hittable_list(globe));
+  options.render(cam, hittable_list(globe));
 }
 
-void perlin_spheres() {
+void perlin_spheres(const render_options& options) {
+  scene_arena arena;
+  material_registry materials(arena);
+
   hittable_list world;
 
   const std::shared_ptr<texture> pertex =
-    std::make_shared<noise_texture>(4.0);
+    arena.make<noise_texture>(4.0);
 
-  world.add(std::make_shared<sphere>(
-    point3(0.0, -1000.0, 0), 1000.0, std::make_shared<lambertian>(pertex)));
-  world.add(std::make_shared<sphere>(
-    point3(0.0, 2.0, 0), 2.0, std::make_shared<lambertian>(pertex)));
+  world.add(arena.make<sphere>(
+    point3(0.0, -1000.0, 0), 1000.0, materials.lambertian(pertex)));
+  world.add(arena.make<sphere>(
+    point3(0.0, 2.0, 0), 2.0, materials.lambertian(pertex)));
 
   camera cam;
 
@@ -170,44 +194,47 @@ void perlin_spheres() {
 
   cam.defocus_angle  = 0.0;
 
-  cam.render(world);
+  options.render(cam, world);
 }
 
-void quads() {
+void quads(const render_options& options) {
+  scene_arena arena;
+  material_registry materials(arena);
+
   hittable_list world;
 
   std::shared_ptr<material> left_red =
-    std::make_shared<lambertian>(color(1.0, 0.2, 0.2));
+    materials.lambertian(color(1.0, 0.2, 0.2));
   std::shared_ptr<material> back_green =
-    std::make_shared<lambertian>(color(0.2, 1.0, 0.2));
+    materials.lambertian(color(0.2, 1.0, 0.2));
   std::shared_ptr<material> right_blue =
-    std::make_shared<lambertian>(color(0.2, 0.2, 1.0));
+    materials.lambertian(color(0.2, 0.2, 1.0));
   std::shared_ptr<material> upper_orange =
-    std::make_shared<lambertian>(color(1.0, 0.5, 0.0));
+    materials.lambertian(color(1.0, 0.5, 0.0));
   std::shared_ptr<material> lower_teal =
-    std::make_shared<lambertian>(color(0.2, 0.8, 0.8));
+    materials.lambertian(color(0.2, 0.8, 0.8));
 
-  world.add(std::make_shared<quad>(
+  world.add(arena.make<quad>(
     point3(-3.0, -2.0, 5.0),
     vec3(0.0, 0.0, -4.0),
     vec3(0.0, 4.0, 0.0),
     left_red));
-  world.add(std::make_shared<quad>(
+  world.add(arena.make<quad>(
     point3(-2.0, -2.0, 0.0),
     vec3(4.0, 0.0, 0.0),
     vec3(0.0, 4.0, 0.0),
     back_green));
-  world.add(std::make_shared<quad>(
+  world.add(arena.make<quad>(
     point3(3.0, -2.0, 1.0),
     vec3(0.0, 0.0, 4.0),
     vec3(0.0, 4.0, 0.0),
     right_blue));
-  world.add(std::make_shared<quad>(
+  world.add(arena.make<quad>(
     point3(-2.0, 3.0, 1.0),
     vec3(4.0, 0.0, 0.0),
     vec3(0.0, 0.0, 4.0),
     upper_orange));
-  world.add(std::make_shared<quad>(
+  world.add(arena.make<quad>(
     point3(-2.0, -3.0, 5.0),
     vec3(4.0, 0.0, 0.0),
     vec3(0.0, 0.0, -4.0),
@@ -228,24 +255,27 @@ void quads() {
 
   cam.defocus_angle = 0.0;
 
-  cam.render(world);
+  options.render(cam, world);
 }
 
-void simple_light() {
+void simple_light(const render_options& options) {
+  scene_arena arena;
+  material_registry materials(arena);
+
   hittable_list world;
 
-  std::shared_ptr<texture> pertex = std::make_shared<noise_texture>(4.0);
+  std::shared_ptr<texture> pertex = arena.make<noise_texture>(4.0);
 
-  world.add(std::make_shared<sphere>(
-    point3(0.0, -1000.0, 0.0), 1000.0, std::make_shared<lambertian>(pertex)));
-  world.add(std::make_shared<sphere>(
-    point3(0.0, 2.0, 0.0), 2.0, std::make_shared<lambertian>(pertex)));
+  world.add(arena.make<sphere>(
+    point3(0.0, -1000.0, 0.0), 1000.0, materials.lambertian(pertex)));
+  world.add(arena.make<sphere>(
+    point3(0.0, 2.0, 0.0), 2.0, materials.lambertian(pertex)));
 
   std::shared_ptr<material> difflight =
-    std::make_shared<diffuse_light>(color(4.0, 4.0, 4.0));
-  world.add(std::make_shared<sphere>(
+    materials.diffuse_light(color(4.0, 4.0, 4.0));
+  world.add(arena.make<sphere>(
     point3(0.0, 7.0, 0.0), 2.0, difflight));
-  world.add(std::make_shared<quad>(
+  world.add(arena.make<quad>(
     point3(3.0, 1.0, -2.0), vec3(2.0, 0.0, 0.0), vec3(0.0, 2.0, 0.0),
     difflight));
 
@@ -264,47 +294,50 @@ void simple_light() {
 
   cam.defocus_angle = 0.0;
 
-  cam.render(world);
+  options.render(cam, world);
 }
 
-void cornell_box() {
+void cornell_box(const render_options& options) {
+  scene_arena arena;
+  material_registry materials(arena);
+
   hittable_list world;
 
   const std::shared_ptr<material> red =
-    std::make_shared<lambertian>(color(0.65, 0.05, 0.05));
+    materials.lambertian(color(0.65, 0.05, 0.05));
   const std::shared_ptr<material> white =
-    std::make_shared<lambertian>(color(0.73, 0.73, 0.73));
+    materials.lambertian(color(0.73, 0.73, 0.73));
   const std::shared_ptr<material> green =
-    std::make_shared<lambertian>(color(0.12, 0.45, 0.15));
+    materials.lambertian(color(0.12, 0.45, 0.15));
   const std::shared_ptr<material> light =
-    std::make_shared<diffuse_light>(color(15.0, 15.0, 15.0));
+    materials.diffuse_light(color(15.0, 15.0, 15.0));
 
-  world.add(std::make_shared<quad>(
+  world.add(arena.make<quad>(
     point3(555.0, 0.0, 0.0),
     vec3(0.0, 555.0, 0.0),
     vec3(0.0, 0.0, 555.0),
     green));
-  world.add(std::make_shared<quad>(
+  world.add(arena.make<quad>(
     point3(0.0, 0.0, 0.0),
     vec3(0.0, 555.0, 0.0),
     vec3(0.0, 0.0, 555.0),
     red));
-  world.add(std::make_shared<quad>(
+  world.add(arena.make<quad>(
     point3(343.0, 544.0, 343.0),
     vec3(-130.0, 0.0, 0.0),
     vec3(0.0, 0.0, -105.0),
     light));
-  world.add(std::make_shared<quad>(
+  world.add(arena.make<quad>(
     point3(0.0, 0.0, 0.0),
     vec3(555.0, 0.0, 0.0),
     vec3(0.0, 0.0, 555.0),
     white));
-  world.add(std::make_shared<quad>(
+  world.add(arena.make<quad>(
     point3(555.0, 555.0, 555.0),
     vec3(-555.0, 0.0, 0.0),
     vec3(0.0, 0.0, -555.0),
     white));
-  world.add(std::make_shared<quad>(
+  world.add(arena.make<quad>(
     point3(0.0, 0.0, 555.0),
     vec3(555.0, 0.0, 0.0),
     vec3(0.0, 555.0, 0.0),
@@ -312,20 +345,22 @@ void cornell_box() {
 
   {
     std::shared_ptr<hittable> box1 =
-      box(point3(0.0, 0.0, 0.0), point3(165.0, 330.0, 165.0), white);
-    box1 = std::make_shared<rotate_y>(box1, 15.0);
-    box1 = std::make_shared<translate>(box1, vec3(265.0, 0.0, 295.0));
+      box(point3(0.0, 0.0, 0.0), point3(165.0, 330.0, 165.0), white, arena);
+    box1 = arena.make<rotate_y>(box1, 15.0);
+    box1 = arena.make<translate>(box1, vec3(265.0, 0.0, 295.0));
     world.add(box1);
   }
 
   {
     std::shared_ptr<hittable> box2 =
-      box(point3(0.0, 0.0, 0.0), point3(165.0, 165.0, 165.0), white);
-    box2 = std::make_shared<rotate_y>(box2, -18.0);
-    box2 = std::make_shared<translate>(box2, vec3(130.0, 0.0, 65.0));
+      box(point3(0.0, 0.0, 0.0), point3(165.0, 165.0, 165.0), white, arena);
+    box2 = arena.make<rotate_y>(box2, -18.0);
+    box2 = arena.make<translate>(box2, vec3(130.0, 0.0, 65.0));
     world.add(box2);
   }
 
+  world = hittable_list(arena.make<flat_bvh>(world));
+
   camera cam;
   
   cam.aspect_ratio = 1.0;
@@ -341,47 +376,50 @@ void cornell_box() {
 
   cam.defocus_angle = 0.0;
 
-  cam.render(world);
+  options.render(cam, world);
 }
 
-void cornell_smoke() {
+void cornell_smoke(const render_options& options) {
+  scene_arena arena;
+  material_registry materials(arena);
+
   hittable_list world;
 
   const std::shared_ptr<material> red =
-    std::make_shared<lambertian>(color(0.65, 0.05, 0.05));
+    materials.lambertian(color(0.65, 0.05, 0.05));
   const std::shared_ptr<material> white =
-    std::make_shared<lambertian>(color(0.73, 0.73, 0.73));
+    materials.lambertian(color(0.73, 0.73, 0.73));
   const std::shared_ptr<material> green =
-    std::make_shared<lambertian>(color(0.12, 0.45, 0.15));
+    materials.lambertian(color(0.12, 0.45, 0.15));
   const std::shared_ptr<material> light =
-    std::make_shared<diffuse_light>(color(7.0, 7.0, 7.0));
+    materials.diffuse_light(color(7.0, 7.0, 7.0));
 
-  world.add(std::make_shared<quad>(
+  world.add(arena.make<quad>(
     point3(555.0, 0.0, 0.0),
     vec3(0.0, 555.0, 0.0),
     vec3(0.0, 0.0, 555.0),
     green));
-  world.add(std::make_shared<quad>(
+  world.add(arena.make<quad>(
     point3(0.0, 0.0, 0.0),
     vec3(0.0, 555.0, 0.0),
     vec3(0.0, 0.0, 555.0),
     red));
-  world.add(std::make_shared<quad>(
+  world.add(arena.make<quad>(
     point3(113.0, 554.0, 127.0),
     vec3(330.0, 0.0, 0.0),
     vec3(0.0, 0.0, 305.0),
     light));
-  world.add(std::make_shared<quad>(
+  world.add(arena.make<quad>(
     point3(0.0, 0.0, 0.0),
     vec3(555.0, 0.0, 0.0),
     vec3(0.0, 0.0, 555.0),
     white));
-  world.add(std::make_shared<quad>(
+  world.add(arena.make<quad>(
     point3(555.0, 555.0, 555.0),
     vec3(-555.0, 0.0, 0.0),
     vec3(0.0, 0.0, -555.0),
     white));
-  world.add(std::make_shared<quad>(
+  world.add(arena.make<quad>(
     point3(0.0, 0.0, 555.0),
     vec3(555.0, 0.0, 0.0),
     vec3(0.0, 555.0, 0.0),
@@ -389,22 +427,24 @@ void cornell_smoke() {
 
   {
     std::shared_ptr<hittable> box1 =
-      box(point3(0.0, 0.0, 0.0), point3(165.0, 330.0, 165.0), white);
-    box1 = std::make_shared<rotate_y>(box1, 15.0);
-    box1 = std::make_shared<translate>(box1, vec3(265.0, 0.0, 295.0));
-    world.add(std::make_shared<constant_medium>(
-      box1, 0.01, color(0.0, 0.0, 0.0)));
+      box(point3(0.0, 0.0, 0.0), point3(165.0, 330.0, 165.0), white, arena);
+    box1 = arena.make<rotate_y>(box1, 15.0);
+    box1 = arena.make<translate>(box1, vec3(265.0, 0.0, 295.0));
+    world.add(arena.make<constant_medium>(
+      box1, 0.01, materials.isotropic(color(0.0, 0.0, 0.0))));
   }
 
   {
     std::shared_ptr<hittable> box2 =
-      box(point3(0.0, 0.0, 0.0), point3(165.0, 165.0, 165.0), white);
-    box2 = std::make_shared<rotate_y>(box2, -18.0);
-    box2 = std::make_shared<translate>(box2, vec3(130.0, 0.0, 65.0));
-    world.add(std::make_shared<constant_medium>(
-      box2, 0.01, color(1.0, 1.0, 1.0)));
+      box(point3(0.0, 0.0, 0.0), point3(165.0, 165.0, 165.0), white, arena);
+    box2 = arena.make<rotate_y>(box2, -18.0);
+    box2 = arena.make<translate>(box2, vec3(130.0, 0.0, 65.0));
+    world.add(arena.make<constant_medium>(
+      box2, 0.01, materials.isotropic(color(1.0, 1.0, 1.0))));
   }
 
+  world = hittable_list(arena.make<flat_bvh>(world));
+
   camera cam;
   
   cam.aspect_ratio = 1.0;
@@ -420,14 +460,91 @@ void cornell_smoke() {
 
   cam.defocus_angle = 0.0;
 
-  cam.render(world);
+  options.render(cam, world);
+}
+
+void grid_smoke(const render_options& options) {
+  scene_arena arena;
+  material_registry materials(arena);
+
+  hittable_list world;
+
+  const std::shared_ptr<material> red =
+    materials.lambertian(color(0.65, 0.05, 0.05));
+  const std::shared_ptr<material> white =
+    materials.lambertian(color(0.73, 0.73, 0.73));
+  const std::shared_ptr<material> green =
+    materials.lambertian(color(0.12, 0.45, 0.15));
+  const std::shared_ptr<material> light =
+    materials.diffuse_light(color(7.0, 7.0, 7.0));
+
+  world.add(arena.make<quad>(
+    point3(555.0, 0.0, 0.0),
+    vec3(0.0, 555.0, 0.0),
+    vec3(0.0, 0.0, 555.0),
+    green));
+  world.add(arena.make<quad>(
+    point3(0.0, 0.0, 0.0),
+    vec3(0.0, 555.0, 0.0),
+    vec3(0.0, 0.0, 555.0),
+    red));
+  world.add(arena.make<quad>(
+    point3(113.0, 554.0, 127.0),
+    vec3(330.0, 0.0, 0.0),
+    vec3(0.0, 0.0, 305.0),
+    light));
+  world.add(arena.make<quad>(
+    point3(0.0, 0.0, 0.0),
+    vec3(555.0, 0.0, 0.0),
+    vec3(0.0, 0.0, 555.0),
+    white));
+  world.add(arena.make<quad>(
+    point3(555.0, 555.0, 555.0),
+    vec3(-555.0, 0.0, 0.0),
+    vec3(0.0, 0.0, -555.0),
+    white));
+  world.add(arena.make<quad>(
+    point3(0.0, 0.0, 555.0),
+    vec3(555.0, 0.0, 0.0),
+    vec3(0.0, 555.0, 0.0),
+    white));
+
+  const std::shared_ptr<density_grid> cloud =
+    arena.make<density_grid>(density_grid::from_perlin(64, 64, 64, 3.0));
+  world.add(arena.make<grid_medium>(
+    aabb(point3(80.0, 40.0, 80.0), point3(475.0, 435.0, 475.0)),
+    cloud,
+    0.04,
+    materials.isotropic(color(0.9, 0.9, 0.9))));
+
+  world = hittable_list(arena.make<flat_bvh>(world));
+
+  camera cam;
+
+  cam.aspect_ratio = 1.0;
+  cam.image_width = 600;
+  cam.samples_per_pixel = 100;
+  cam.max_depth = 15;
+  cam.background = color(0.0, 0.0, 0.0);
+
+  cam.vfov = 40.0;
+  cam.lookfrom = point3(278.0, 278.0, -800.0);
+  cam.lookat = point3(278.0, 278.0, 0.0);
+  cam.vup = vec3(0.0, 1.0, 0.0);
+
+  cam.defocus_angle = 0.0;
+
+  options.render(cam, world);
 }
 
-void final_scene(int image_width, int samples_per_pixel, int max_depth) {
-  hittable_list boxes1;
+void final_scene(const render_options& options) {
+  scene_arena arena;
+  material_registry materials(arena);
+
+  std::vector<box_data> boxes1;
 
   const std::shared_ptr<material> ground =
-    std::make_shared<lambertian>(color(0.48, 0.83, 0.53));
+    materials.lambertian(color(0.48, 0.83, 0.53));
 
   const int boxes_per_side = 20;
   const double w = 100.0;
@@ -440,17 +557,17 @@ void final_scene(int image_width, int samples_per_pixel, int max_depth) {
       const double y1 = random_double(1.0, 101.0);
       const double z1 = z0 + w;
 
-      boxes1.add(box(point3(x0, y0, z0), point3(x1, y1, z1), ground));
+      boxes1.push_back(make_box_data(point3(x0, y0, z0), point3(x1, y1, z1)));
     }
   }
 
   hittable_list world;
 
-  world.add(std::make_shared<bvh_node>(boxes1));
+  world.add(arena.make<flat_bvh>(boxes1, ground));
 
   const std::shared_ptr<material> light =
-    std::make_shared<diffuse_light>(color(7.0, 7.0, 7.0));
-  world.add(std::make_shared<quad>(
+    materials.diffuse_light(color(7.0, 7.0, 7.0));
+  world.add(arena.make<quad>(
             point3(123.0, 554.0, 147.0),
             vec3(300.0, 0.0, 0.0),
             vec3(0.0, 0.0, 265.0),
@@ -459,70 +576,72 @@ void final_scene(int image_width, int samples_per_pixel, int max_depth) {
   const point3 center1 = point3(400.0, 400.0, 200.0);
   const point3 center2 = center1 + vec3(30.0, 0.0, 0.0);
   const std::shared_ptr<material> sphere_material =
-    std::make_shared<lambertian>(color(0.7, 0.3, 0.1));
-  world.add(std::make_shared<sphere>(
+    materials.lambertian(color(0.7, 0.3, 0.1));
+  world.add(arena.make<sphere>(
             center1, center2, 50.0, sphere_material));
 
-  world.add(std::make_shared<sphere>(
+  world.add(arena.make<sphere>(
             point3(260.0, 150.0, 45.0),
             50.0,
-            std::make_shared<dielectric>(1.5)));
-  world.add(std::make_shared<sphere>(
+            materials.dielectric(1.5)));
+  world.add(arena.make<sphere>(
             point3(0.0, 150.0, 145.0),
             50.0,
-            std::make_shared<metal>(color(0.8, 0.8, 0.9), 1.0)));
+            materials.metal(color(0.8, 0.8, 0.9), 1.0)));
 
   std::shared_ptr<hittable> boundary =
-    std::make_shared<sphere>(
+    arena.make<sphere>(
       point3(360.0, 150.0, 145.0),
       70.0,
-      std::make_shared<dielectric>(1.5));
+      materials.dielectric(1.5));
   world.add(boundary);
-  world.add(std::make_shared<constant_medium>(
+  world.add(arena.make<constant_medium>(
             boundary,
             0.2,
-            color(0.2, 0.4, 0.9)));
-  boundary = std::make_shared<sphere>(
-    point3(0.0, 0.0, 0.0), 5000.0, std::make_shared<dielectric>(1.5));
-  world.add(std::make_shared<constant_medium>(
+            materials.isotropic(color(0.2, 0.4, 0.9))));
+  boundary = arena.make<sphere>(
+    point3(0.0, 0.0, 0.0), 5000.0, materials.dielectric(1.5));
+  world.add(arena.make<constant_medium>(
             boundary,
             0.0001,
-            color(1.0, 1.0, 1.0)));
+            materials.isotropic(color(1.0, 1.0, 1.0))));
 
   const std::shared_ptr<material> emat =
-    std::make_shared<lambertian>(
-      std::make_shared<image_texture>("earthmap.jpg"));
-  world.add(std::make_shared<sphere>(
+    materials.lambertian(
+      arena.make<image_texture>("earthmap.jpg"));
+  world.add(arena.make<sphere>(
             point3(400.0, 200.0, 400.0),
             100.0,
             emat));
   const std::shared_ptr<texture> pertex =
-    std::make_shared<noise_texture>(0.2);
-  world.add(std::make_shared<sphere>(
+    arena.make<noise_texture>(0.2);
+  world.add(arena.make<sphere>(
             point3(220.0, 280.0, 300.0),
             80.0,
-            std::make_shared<lambertian>(pertex)));
+            materials.lambertian(pertex)));
 
   hittable_list boxes2;
   const std::shared_ptr<material> white =
-    std::make_shared<lambertian>(color(0.73, 0.73, 0.73));
+    materials.lambertian(color(0.73, 0.73, 0.73));
   const int sphere_number = 1000;
   for (int j = 0; j < sphere_number; ++j) {
-    boxes2.add(std::make_shared<sphere>(point3::random(0.0, 165.0), 10, white));
+    boxes2.add(arena.make<sphere>(point3::random(0.0, 165.0), 10, white));
   }
 
-  world.add(std::make_shared<translate>(
-    std::make_shared<rotate_y>(
-      std::make_shared<bvh_node>(boxes2),
+  world.add(arena.make<translate>(
+    arena.make<rotate_y>(
+      arena.make<flat_bvh>(boxes2),
       15),
     vec3(-100.0, 270.0, 395.0)));
 
+  world = hittable_list(arena.make<flat_bvh>(world));
+
   camera cam;
 
   cam.aspect_ratio = 1.0;
-  cam.image_width = image_width;
-  cam.samples_per_pixel = samples_per_pixel;
-  cam.max_depth = max_depth;
+  cam.image_width = 800;
+  cam.samples_per_pixel = 10000;
+  cam.max_depth = 40;
   cam.background = color(0.0, 0.0, 0.0);
 
   cam.vfov = 40;
@@ -532,40 +651,131 @@ void final_scene(int image_width, int samples_per_pixel, int max_depth) {
 
   cam.defocus_angle = 0.0;
 
-  cam.render(world);
+  options.render(cam, world);
+}
+
+// A binary scene is only mapped, its trees are used from the file.
+int render_binary_scene(const render_options& options) {
+  timer load_timer;
+  binary_scene scene;
+  if (!scene.load(options.scene_file, std::cerr)) {
+    return 1;
+  }
+  std::clog << "Mapped " << scene.file_bytes() << " bytes, "
+    << scene.tree_count() << " trees in " << load_timer.seconds() << " s\n";
+
+  timer render_timer;
+  options.render(scene.cam(), scene.world());
+  if (options.convert_path.empty()) {
+    std::clog << "Rendered in " << render_timer.seconds() << " s\n";
+  }
+  return options.failed() ? 1 : 0;
+}
+
+// Reading the file and building its BVH are timed apart from the render,
+// so a slow start can be told from a slow scene.
+int render_scene_file(const render_options& options) {
+  if (binary_scene::matches(options.scene_file)) {
+    return render_binary_scene(options);
+  }
+
+  scene_file scene;
+  if (!scene.load(options.scene_file, std::cerr)) {
+    return 1;
+  }
+  std::clog << "Parsed " << scene.line_count() << " lines, "
+    << scene.object_count() << " objects in " << scene.parse_seconds()
+    << " s, built the BVH in " << scene.build_seconds() << " s\n";
+
+  timer render_timer;
+  options.render(scene.cam(), scene.world());
+  if (options.convert_path.empty()) {
+    std::clog << "Rendered in " << render_timer.seconds() << " s\n";
+  }
+  return options.failed() ? 1 : 0;
+}
+
+struct scene_entry {
+  const char* name;
+  void (*render)(const render_options&);
+};
+
+// In the order of the books; the numbers given to --scene count from one.
+const scene_entry scenes[] = {
+  { "bouncing_spheres", bouncing_spheres },
+  { "checkered_spheres", checkered_spheres },
+  { "earth", earth },
+  { "perlin_spheres", perlin_spheres },
+  { "quads", quads },
+  { "simple_light", simple_light },
+  { "cornell_box", cornell_box },
+  { "cornell_smoke", cornell_smoke },
+  { "final_scene", final_scene },
+  { "grid_smoke", grid_smoke },
+};
+
+const scene_entry* find_scene(const std::string& key) {
+  const int count = static_cast<int>(sizeof(scenes) / sizeof(scenes[0]));
+  for (int i = 0; i < count; ++i) {
+    if (key == scenes[i].name || key == std::to_string(i + 1)) {
+      return &scenes[i];
+    }
+  }
+  return nullptr;
 }
 
-int main() {
-  switch(9) {
-    case 1:
-      bouncing_spheres();
-      break;
-    case 2:
-      checkered_spheres();
-      break;
-    case 3:
-      earth();
-      break;
-    case 4:
-      perlin_spheres();
-      break;
-    case 5:
-      quads();
-      break;
-    case 6:
-      simple_light();
-      break;
-    case 7:
-      cornell_box();
-      break;
-    case 8:
-      cornell_smoke();
-      break;
-    case 9:
-      final_scene(800, 10000, 40);
-      break;
-    default:
-      break;
+int main(int argc, char** argv) {
+  render_options options;
+  if (!options.parse(argc, argv, std::cerr)) {
+    render_options::usage(std::cerr, argv[0]);
+    return 1;
+  }
+
+  if (options.help) {
+    render_options::usage(std::cout, argv[0]);
+    return 0;
+  }
+
+  if (options.list_scenes) {
+    int number = 1;
+    for (const scene_entry& entry : scenes) {
+      std::cout << number++ << " " << entry.name << "\n";
+    }
+    return 0;
+  }
+
+  if (options.noise_report) {
+    // Over the noise sphere of perlin_spheres.
+    noise_volume::report(
+      std::cout, perlin(), noise_texture::turbulence_depth,
+      aabb(point3(-2, 0, -2), point3(2, 4, 2)), {16, 32, 64, 128});
+    return 0;
+  }
+
+  if (options.bench_noise) {
+    book_perlin::report(std::cout, noise_texture::turbulence_depth);
+    return 0;
+  }
+
+  if (!options.merge_paths.empty()) {
+    return options.merge() ? 0 : 1;
   }
-  return 0;
+
+  if (!options.scene_file.empty()) {
+    const int status = render_scene_file(options);
+    texture_cache::global().report(std::clog);
+    return status;
+  }
+
+  const scene_entry* entry = find_scene(options.scene);
+  if (!entry) {
+    std::cerr << "ERROR: Unknown scene '" << options.scene
+      << "', see --list\n";
+    return 1;
+  }
+
+  entry->render(options);
+
+  texture_cache::global().report(std::clog);
+  return options.failed() ? 1 : 0;
 }
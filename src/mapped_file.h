@@ -0,0 +1,126 @@
+#ifndef _MAPPED_FILE_H_
+#define _MAPPED_FILE_H_
+
+#include <cstddef>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// A whole file mapped read-only into memory. Pages are only read from disk
+// when first touched, and are shared with every process mapping the same
+// file.
+class mapped_file {
+ public:
+  mapped_file() {}
+  ~mapped_file() { close(); }
+
+  mapped_file(const mapped_file&) = delete;
+  mapped_file& operator=(const mapped_file&) = delete;
+
+  // Returns false if the file cannot be opened or is empty.
+  bool open(const std::string& path) {
+    close();
+
+#ifdef _WIN32
+    m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                         nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                         nullptr);
+    if (m_file == INVALID_HANDLE_VALUE) {
+      return false;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(m_file, &size) || size.QuadPart == 0) {
+      close();
+      return false;
+    }
+
+    m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0,
+                                   nullptr);
+    if (!m_mapping) {
+      close();
+      return false;
+    }
+
+    m_data = static_cast<const unsigned char*>(
+      MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+    if (!m_data) {
+      close();
+      return false;
+    }
+    m_size = static_cast<size_t>(size.QuadPart);
+#else
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+      ::close(fd);
+      return false;
+    }
+
+    void* data = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ,
+                      MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+      return false;
+    }
+
+    m_data = static_cast<const unsigned char*>(data);
+    m_size = static_cast<size_t>(info.st_size);
+#endif
+
+    return true;
+  }
+
+  void close() {
+#ifdef _WIN32
+    if (m_data) {
+      UnmapViewOfFile(m_data);
+    }
+    if (m_mapping) {
+      CloseHandle(m_mapping);
+    }
+    if (m_file != INVALID_HANDLE_VALUE) {
+      CloseHandle(m_file);
+    }
+    m_mapping = nullptr;
+    m_file = INVALID_HANDLE_VALUE;
+#else
+    if (m_data) {
+      munmap(const_cast<unsigned char*>(m_data), m_size);
+    }
+#endif
+    m_data = nullptr;
+    m_size = 0;
+  }
+
+  bool is_open() const { return m_data != nullptr; }
+  const unsigned char* data() const { return m_data; }
+  size_t size() const { return m_size; }
+
+ private:
+  const unsigned char* m_data = nullptr;
+  size_t               m_size = 0;
+#ifdef _WIN32
+  HANDLE               m_file = INVALID_HANDLE_VALUE;
+  HANDLE               m_mapping = nullptr;
+#endif
+};
+
+#endif  // _MAPPED_FILE_H_
@@ -5,10 +5,28 @@
 #include "texture.h"
 
 class hit_record;
+
+// Concrete material kinds known to the renderer, so batched shading can
+// group hits and run one non-virtual kernel per kind.
+enum class material_type {
+  generic,
+  lambertian,
+  metal,
+  dielectric,
+  diffuse_light,
+  isotropic
+};
+
 class material {
  public:
   virtual ~material() = default;
 
+  virtual material_type type() const { return material_type::generic; }
+
+  // Texture sampled while shading, used together with type() as the
+  // grouping key of batched shading.
+  virtual const texture* shading_texture() const { return nullptr; }
+
   virtual color emitted(double u, double v, const point3& p) const {
     return color(0.0, 0.0, 0.0);
   }
@@ -21,9 +39,26 @@ class material {
   ) const {
     return false;
   }
+
+ protected:
+  // Cone spread given to rays leaving diffuse surfaces and media. Their
+  // texture lookups are averaged over the whole lobe anyway, so a coarse
+  // mip level is enough.
+  static const double diffuse_cone_spread;
+
+  // Continues the incoming ray cone from the hit point with a new spread.
+  static void continue_cone(
+    const ray& r_in,
+    const hit_record& rec,
+    double spread,
+    ray& scattered) {
+    scattered.set_cone(r_in.width_at(rec.t), spread);
+  }
 };
 
-class lambertian : public material {
+const double material::diffuse_cone_spread = 0.2;
+
+class lambertian final : public material {
  public:
   lambertian(const color& albedo)
   : m_tex(std::make_shared<solid_color>(albedo)) {}
@@ -43,15 +78,22 @@ class lambertian : public material {
     }
 
     scattered = ray(rec.p, scatter_direction, r_in.time());
-    attenuation = m_tex->value(rec.u, rec.v, rec.p);
+    continue_cone(r_in, rec, diffuse_cone_spread, scattered);
+    attenuation = m_tex->filtered_value(rec.u, rec.v, rec.p, rec.footprint);
     return true;
   }
 
+  material_type type() const override {
+    return material_type::lambertian;
+  }
+
+  const texture* shading_texture() const override { return m_tex.get(); }
+
  private:
   std::shared_ptr<texture> m_tex;
 };
 
-class metal : public material {
+class metal final : public material {
  public:
   metal(const color& albedo, double fuzz) 
   : m_albedo(albedo), m_fuzz(fuzz < 1.0 ? fuzz : 1.0) {}
@@ -65,16 +107,24 @@ class metal : public material {
     vec3 reflected = reflect(r_in.direction(), rec.normal);
     reflected = unit_vector(reflected) + (m_fuzz * random_unit_vector());
     scattered = ray(rec.p, reflected, r_in.time());
+    continue_cone(r_in, rec, r_in.cone_spread() + m_fuzz, scattered);
     attenuation = m_albedo;
     return (dot(scattered.direction(), rec.normal) > 0.0);
   }
 
+  material_type type() const override {
+    return material_type::metal;
+  }
+
+  const color& albedo() const { return m_albedo; }
+  double fuzz() const { return m_fuzz; }
+
  private:
   color m_albedo;
   double m_fuzz;
 };
 
-class dielectric : public material {
+class dielectric final : public material {
  public:
   dielectric(double refraction_index) : m_refraction_index(refraction_index) {}
 
@@ -102,9 +152,16 @@ class dielectric : public material {
     }
 
     scattered = ray(rec.p, direction, r_in.time());
+    continue_cone(r_in, rec, r_in.cone_spread(), scattered);
     return true;
   }
   
+  material_type type() const override {
+    return material_type::dielectric;
+  }
+
+  double refraction_index() const { return m_refraction_index; }
+
  private:
   double m_refraction_index;
 
@@ -115,7 +172,7 @@ class dielectric : public material {
   }
 };
 
-class diffuse_light : public material {
+class diffuse_light final : public material {
  public:
   diffuse_light(std::shared_ptr<texture> tex) : m_tex(tex) {}
 
@@ -126,11 +183,17 @@ class diffuse_light : public material {
     return m_tex->value(u, v, p);
   }
 
+  material_type type() const override {
+    return material_type::diffuse_light;
+  }
+
+  const texture* shading_texture() const override { return m_tex.get(); }
+
  private:
   std::shared_ptr<texture> m_tex;
 };
 
-class isotropic : public material {
+class isotropic final : public material {
  public:
   isotropic(const color& albedo) 
   : m_tex(std::make_shared<solid_color>(albedo)) {}
@@ -144,10 +207,17 @@ class isotropic : public material {
     color& attenuation,
     ray& scattered) const override {
     scattered = ray(rec.p, random_unit_vector(), r_in.time());
-    attenuation = m_tex->value(rec.u, rec.v, rec.p);
+    continue_cone(r_in, rec, diffuse_cone_spread, scattered);
+    attenuation = m_tex->filtered_value(rec.u, rec.v, rec.p, rec.footprint);
     return true;
   }
 
+  material_type type() const override {
+    return material_type::isotropic;
+  }
+
+  const texture* shading_texture() const override { return m_tex.get(); }
+
  private:
   std::shared_ptr<texture> m_tex;
 };
@@ -0,0 +1,139 @@
+#ifndef _MATERIAL_REGISTRY_H_
+#define _MATERIAL_REGISTRY_H_
+
+#include "arena.h"
+#include "material.h"
+#include "rtweekend.h"
+#include "texture.h"
+
+#include <cstdint>
+#include <map>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+// Interns materials and solid color textures by their parameters, so a
+// scene asking twice for lambertian(color(0.73, 0.73, 0.73)) gets the same
+// object back. Each distinct material also gets a dense index in order of
+// creation. Since shading groups hits by material, equal materials end up in
+// one batch. Objects are allocated from the scene arena and live as long as
+// it does.
+class material_registry {
+ public:
+  explicit material_registry(scene_arena& arena) : m_arena(arena) {}
+
+  material_registry(const material_registry&) = delete;
+  material_registry& operator=(const material_registry&) = delete;
+
+  std::shared_ptr<texture> solid(const color& albedo) {
+    const color_key key = make_key(albedo);
+    auto found = m_solids.find(key);
+    if (found != m_solids.end()) {
+      ++m_reused;
+      return found->second;
+    }
+
+    const std::shared_ptr<texture> tex = m_arena.make<solid_color>(albedo);
+    m_solids.emplace(key, tex);
+    return tex;
+  }
+
+  std::shared_ptr<material> lambertian(const color& albedo) {
+    return lambertian(solid(albedo));
+  }
+
+  std::shared_ptr<material> lambertian(std::shared_ptr<texture> tex) {
+    return intern<::lambertian>(
+      material_key_of(material_type::lambertian, tex.get()), tex);
+  }
+
+  std::shared_ptr<material> metal(const color& albedo, double fuzz) {
+    return intern<::metal>(
+      material_key_of(material_type::metal, nullptr, albedo, fuzz),
+      albedo, fuzz);
+  }
+
+  std::shared_ptr<material> dielectric(double refraction_index) {
+    return intern<::dielectric>(
+      material_key_of(
+        material_type::dielectric, nullptr, color(), refraction_index),
+      refraction_index);
+  }
+
+  std::shared_ptr<material> diffuse_light(const color& emit) {
+    return diffuse_light(solid(emit));
+  }
+
+  std::shared_ptr<material> diffuse_light(std::shared_ptr<texture> tex) {
+    return intern<::diffuse_light>(
+      material_key_of(material_type::diffuse_light, tex.get()), tex);
+  }
+
+  std::shared_ptr<material> isotropic(const color& albedo) {
+    return isotropic(solid(albedo));
+  }
+
+  std::shared_ptr<material> isotropic(std::shared_ptr<texture> tex) {
+    return intern<::isotropic>(
+      material_key_of(material_type::isotropic, tex.get()), tex);
+  }
+
+  // Dense index of a material created by this registry, or -1 otherwise.
+  int index_of(const material* mat) const {
+    auto found = m_index.find(mat);
+    return found != m_index.end() ? static_cast<int>(found->second) : -1;
+  }
+
+  const std::shared_ptr<material>& at(size_t index) const {
+    return m_materials[index];
+  }
+
+  size_t material_count() const { return m_materials.size(); }
+  size_t texture_count() const { return m_solids.size(); }
+
+  // Number of requests answered with an already existing object.
+  size_t reuse_count() const { return m_reused; }
+
+ private:
+  using color_key = std::tuple<double, double, double>;
+  using material_key =
+    std::tuple<material_type, const texture*, double, double, double, double>;
+
+  scene_arena&                                  m_arena;
+  std::map<color_key, std::shared_ptr<texture>> m_solids;
+  std::map<material_key, uint32_t>              m_lookup;
+  std::map<const material*, uint32_t>           m_index;
+  std::vector<std::shared_ptr<material>>        m_materials;
+  size_t                                        m_reused = 0;
+
+  static color_key make_key(const color& c) {
+    return color_key(c.x(), c.y(), c.z());
+  }
+
+  static material_key material_key_of(
+    material_type type,
+    const texture* tex,
+    const color& c = color(),
+    double param = 0.0) {
+    return material_key(type, tex, c.x(), c.y(), c.z(), param);
+  }
+
+  template <typename T, typename... Args>
+  std::shared_ptr<material> intern(const material_key& key, Args&&... args) {
+    auto found = m_lookup.find(key);
+    if (found != m_lookup.end()) {
+      ++m_reused;
+      return m_materials[found->second];
+    }
+
+    const std::shared_ptr<material> mat =
+      m_arena.make<T>(std::forward<Args>(args)...);
+    const uint32_t index = static_cast<uint32_t>(m_materials.size());
+    m_materials.push_back(mat);
+    m_lookup.emplace(key, index);
+    m_index.emplace(mat.get(), index);
+    return mat;
+  }
+};
+
+#endif  // _MATERIAL_REGISTRY_H_
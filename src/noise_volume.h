@@ -0,0 +1,175 @@
+#ifndef _NOISE_VOLUME_H_
+#define _NOISE_VOLUME_H_
+
+#include "rtweekend.h"
+#include "aabb.h"
+#include "perlin.h"
+
+#include <algorithm>
+#include <chrono>
+#include <ostream>
+#include <vector>
+
+// Perlin turbulence baked into a grid over a box, for textures that would
+// otherwise evaluate every octave at every hit. Samples sit on the grid
+// corners, so the box edges are represented exactly, and are read back with
+// trilinear interpolation. They are stored in bricks of brick_size^3, so the
+// eight samples of a lookup usually share a cache line or two. Detail finer
+// than the grid spacing is lost; report() measures how much that costs.
+class noise_volume {
+ public:
+  static const int brick_size = 4;
+
+  // resolution is the number of samples along the longest side of bounds;
+  // the other sides get as many as keeps the spacing roughly even.
+  noise_volume(
+    const perlin& noise, int depth, const aabb& bounds, int resolution)
+  : m_bounds(bounds) {
+    double longest = 0.0;
+    for (int axis = 0; axis < 3; ++axis) {
+      longest = fmax(longest, bounds.axis_interval(axis).size());
+    }
+
+    for (int axis = 0; axis < 3; ++axis) {
+      const double extent = bounds.axis_interval(axis).size();
+      m_size[axis] = std::max(
+        2, static_cast<int>(ceil(resolution * extent / longest)));
+      m_bricks[axis] = (m_size[axis] + brick_size - 1) / brick_size;
+      m_scale[axis] = (m_size[axis] - 1) / extent;
+    }
+
+    m_samples.assign(static_cast<size_t>(m_bricks[0]) * m_bricks[1]
+                     * m_bricks[2] * brick_size * brick_size * brick_size,
+                     0.0f);
+    bake(noise, depth);
+  }
+
+  const aabb& bounds() const { return m_bounds; }
+
+  bool contains(const point3& p) const {
+    return m_bounds.x.contains(p.x()) && m_bounds.y.contains(p.y())
+        && m_bounds.z.contains(p.z());
+  }
+
+  size_t bytes() const { return m_samples.size() * sizeof(float); }
+
+  // Turbulence at a point inside the bounds.
+  double value(const point3& p) const {
+    int cell[3];
+    double f[3];
+    for (int axis = 0; axis < 3; ++axis) {
+      const double g =
+        (p[axis] - m_bounds.axis_interval(axis).min) * m_scale[axis];
+      cell[axis] = std::min(std::max(static_cast<int>(g), 0),
+                            m_size[axis] - 2);
+      f[axis] = g - cell[axis];
+    }
+
+    double accum = 0.0;
+    for (int i = 0; i < 2; ++i) {
+      for (int j = 0; j < 2; ++j) {
+        for (int k = 0; k < 2; ++k) {
+          accum += (i ? f[0] : 1.0 - f[0])
+                 * (j ? f[1] : 1.0 - f[1])
+                 * (k ? f[2] : 1.0 - f[2])
+                 * sample(cell[0] + i, cell[1] + j, cell[2] + k);
+        }
+      }
+    }
+
+    return accum;
+  }
+
+  // For each resolution, bakes a volume and compares it with evaluating the
+  // turbulence directly at random points inside bounds. Prints memory, bake
+  // time, mean and maximum error, and the time per lookup of both.
+  static void report(
+    std::ostream& out, const perlin& noise, int depth, const aabb& bounds,
+    const std::vector<int>& resolutions, int samples = 200000) {
+    using clock = std::chrono::steady_clock;
+
+    std::vector<point3> points(samples);
+    for (point3& p : points) {
+      p = point3(random_double(bounds.x.min, bounds.x.max),
+                 random_double(bounds.y.min, bounds.y.max),
+                 random_double(bounds.z.min, bounds.z.max));
+    }
+
+    std::vector<double> exact(samples);
+    clock::time_point start = clock::now();
+    for (int i = 0; i < samples; ++i) {
+      exact[i] = noise.turb(points[i], depth);
+    }
+    const double exact_ns = nanoseconds_since(start) / samples;
+
+    out << "Noise volume, depth " << depth << ": direct evaluation "
+        << exact_ns << " ns per lookup\n";
+
+    for (int resolution : resolutions) {
+      start = clock::now();
+      const noise_volume volume(noise, depth, bounds, resolution);
+      const double bake_ms = nanoseconds_since(start) * 1e-6;
+
+      double error_sum = 0.0;
+      double error_max = 0.0;
+      start = clock::now();
+      for (int i = 0; i < samples; ++i) {
+        const double error = fabs(volume.value(points[i]) - exact[i]);
+        error_sum += error;
+        error_max = fmax(error_max, error);
+      }
+      const double lookup_ns = nanoseconds_since(start) / samples;
+
+      out << "  " << resolution << "^3: "
+          << volume.bytes() / 1024 << " KB, baked in " << bake_ms << " ms, "
+          << lookup_ns << " ns per lookup, error mean "
+          << error_sum / samples << " max " << error_max << '\n';
+    }
+  }
+
+ private:
+  aabb               m_bounds;
+  int                m_size[3];
+  int                m_bricks[3];
+  double             m_scale[3];
+  std::vector<float> m_samples;
+
+  static double nanoseconds_since(std::chrono::steady_clock::time_point t) {
+    return std::chrono::duration<double, std::nano>(
+      std::chrono::steady_clock::now() - t).count();
+  }
+
+  size_t index(int x, int y, int z) const {
+    const size_t brick =
+      (static_cast<size_t>(z / brick_size) * m_bricks[1] + y / brick_size)
+      * m_bricks[0] + x / brick_size;
+    const int in_brick =
+      ((z % brick_size) * brick_size + y % brick_size) * brick_size
+      + x % brick_size;
+    return brick * brick_size * brick_size * brick_size + in_brick;
+  }
+
+  float sample(int x, int y, int z) const { return m_samples[index(x, y, z)]; }
+
+  void bake(const perlin& noise, int depth) {
+    std::vector<point3> row(m_size[0]);
+    std::vector<double> values(m_size[0]);
+    const point3 lo(m_bounds.x.min, m_bounds.y.min, m_bounds.z.min);
+
+    for (int z = 0; z < m_size[2]; ++z) {
+      for (int y = 0; y < m_size[1]; ++y) {
+        for (int x = 0; x < m_size[0]; ++x) {
+          row[x] = lo + vec3(x / m_scale[0], y / m_scale[1], z / m_scale[2]);
+        }
+        noise.turb(row.data(), values.data(), row.size(), depth);
+        for (int x = 0; x < m_size[0]; ++x) {
+          m_samples[index(x, y, z)] = static_cast<float>(values[x]);
+        }
+      }
+    }
+  }
+};
+
+const int noise_volume::brick_size;
+
+#endif  // _NOISE_VOLUME_H_
@@ -0,0 +1,164 @@
+#ifndef _PERLIN_BENCH_H_
+#define _PERLIN_BENCH_H_
+
+#include "rtweekend.h"
+#include "perlin.h"
+
+#include <algorithm>
+#include <chrono>
+#include <ostream>
+#include <vector>
+
+// The noise kernel of the books, kept to measure perlin against: separate
+// permutation arrays, vec3 gradients and a double precision loop over the
+// corners. It reads the gradients and permutations of a seed's
+// perlin_tables, so both kernels give the same pattern.
+class book_perlin {
+ public:
+  explicit book_perlin(uint32_t seed = perlin::default_seed) {
+    const std::shared_ptr<const perlin_tables> tables =
+      perlin_tables::shared(seed);
+    for (int i = 0; i < point_count; ++i) {
+      const float* g = tables->gradients[i];
+      m_randvec[i] = vec3(g[0], g[1], g[2]);
+      m_perm_x[i] = tables->perm[i][0];
+      m_perm_y[i] = tables->perm[i][1];
+      m_perm_z[i] = tables->perm[i][2];
+    }
+  }
+
+  double noise(const point3& p) const {
+    double u = p.x() - floor(p.x());
+    double v = p.y() - floor(p.y());
+    double w = p.z() - floor(p.z());
+    u = u * u * (3.0 - 2.0 * u);
+    v = v * v * (3.0 - 2.0 * v);
+    w = w * w * (3.0 - 2.0 * w);
+
+    const int i = static_cast<int>(floor(p.x()));
+    const int j = static_cast<int>(floor(p.y()));
+    const int k = static_cast<int>(floor(p.z()));
+
+    vec3 c[2][2][2];
+    for (int di = 0; di < 2; ++di) {
+      for (int dj = 0; dj < 2; ++dj) {
+        for (int dk = 0; dk < 2; ++dk) {
+          c[di][dj][dk] = m_randvec[
+            m_perm_x[(i + di) & 255] ^
+            m_perm_y[(j + dj) & 255] ^
+            m_perm_z[(k + dk) & 255]];
+        }
+      }
+    }
+
+    const double uu = u * u * (3.0 - 2.0 * u);
+    const double vv = v * v * (3.0 - 2.0 * v);
+    const double ww = w * w * (3.0 - 2.0 * w);
+
+    double accum = 0.0;
+    for (int di = 0; di < 2; ++di) {
+      for (int dj = 0; dj < 2; ++dj) {
+        for (int dk = 0; dk < 2; ++dk) {
+          const vec3 weight_v(u - di, v - dj, w - dk);
+          accum += (di * uu + (1 - di) * (1 - uu))
+                 * (dj * vv + (1 - dj) * (1 - vv))
+                 * (dk * ww + (1 - dk) * (1 - ww))
+                 * dot(c[di][dj][dk], weight_v);
+        }
+      }
+    }
+
+    return accum;
+  }
+
+  double turb(const point3& p, int depth) const {
+    double accum = 0.0;
+    point3 temp_p = p;
+    double weight = 1.0;
+
+    for (int i = 0; i < depth; ++i) {
+      accum += weight * noise(temp_p);
+      weight *= 0.5;
+      temp_p *= 2.0;
+    }
+
+    return fabs(accum);
+  }
+
+  // Times turbulence of the given depth at random points with this kernel,
+  // perlin one point at a time and perlin in batches, taking the best of
+  // runs for each, and prints the times and the largest difference from
+  // this kernel.
+  static void report(
+    std::ostream& out, int depth, int samples = 1000000, int runs = 5) {
+    std::vector<point3> points(samples);
+    for (point3& p : points) {
+      p = point3(random_double(-64.0, 64.0), random_double(-64.0, 64.0),
+                 random_double(-64.0, 64.0));
+    }
+
+    const book_perlin book;
+    const perlin noise;
+    std::vector<double> expected(samples);
+    std::vector<double> single(samples);
+    std::vector<double> batch(samples);
+
+    double book_ms = 0.0;
+    double single_ms = 0.0;
+    double batch_ms = 0.0;
+    for (int run = 0; run < runs; ++run) {
+      book_ms = best(book_ms, run, time_ms([&] {
+        for (int i = 0; i < samples; ++i) {
+          expected[i] = book.turb(points[i], depth);
+        }
+      }));
+      single_ms = best(single_ms, run, time_ms([&] {
+        for (int i = 0; i < samples; ++i) {
+          single[i] = noise.turb(points[i], depth);
+        }
+      }));
+      batch_ms = best(batch_ms, run, time_ms([&] {
+        noise.turb(points.data(), batch.data(), points.size(), depth);
+      }));
+    }
+
+    double single_error = 0.0;
+    double batch_error = 0.0;
+    for (int i = 0; i < samples; ++i) {
+      single_error = fmax(single_error, fabs(single[i] - expected[i]));
+      batch_error = fmax(batch_error, fabs(batch[i] - expected[i]));
+    }
+
+    out << "Turbulence, depth " << depth << ", at " << samples
+        << " points, best of " << runs << " runs:\n"
+        << "  book kernel: " << book_ms << " ms\n"
+        << "  perlin, one point: " << single_ms << " ms, max difference "
+        << single_error << "\n"
+        << "  perlin, batches of " << perlin::batch_size << ": "
+        << batch_ms << " ms, max difference " << batch_error << "\n";
+  }
+
+ private:
+  static const int point_count = perlin_tables::point_count;
+
+  vec3 m_randvec[point_count];
+  int  m_perm_x[point_count];
+  int  m_perm_y[point_count];
+  int  m_perm_z[point_count];
+
+  template <typename F>
+  static double time_ms(F work) {
+    const auto start = std::chrono::steady_clock::now();
+    work();
+    return std::chrono::duration<double, std::milli>(
+      std::chrono::steady_clock::now() - start).count();
+  }
+
+  static double best(double so_far, int run, double ms) {
+    return run == 0 ? ms : std::min(so_far, ms);
+  }
+};
+
+const int book_perlin::point_count;
+
+#endif  // _PERLIN_BENCH_H_
@@ -0,0 +1,212 @@
+#ifndef _PREVIEW_H_
+#define _PREVIEW_H_
+
+#include "rtweekend.h"
+#include "camera.h"
+#include "camera_settings.h"
+#include "framebuffer.h"
+#include "hittable.h"
+#include "render_state.h"
+#include "timer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+// Renders a preview that sharpens while it is looked at: one sample per
+// pixel at 1/8, 1/4 and 1/2 of the width, shown scaled up, then the full
+// width gaining one sample per pixel each pass up to samples_per_pixel.
+// The image is written after every level and then every update_interval
+// seconds, either to a temporary file renamed over the output path, so a
+// viewer never reads half of one, or to standard output as a stream of
+// images.
+//
+// With a watch file of camera settings, one per line as sent to the render
+// server, the preview starts over whenever the file changes, with the
+// scene still loaded. A "quit" line ends it. Without a watch file it ends
+// once it reaches full quality.
+class preview_renderer {
+ public:
+  double      update_interval = 0.25;
+  std::string watch_path;
+
+  preview_renderer(const camera& cam, const hittable& world)
+  : m_camera(cam), m_world(world) {}
+
+  // Returns false if an image cannot be written.
+  bool render() {
+    std::string settings;
+    read_watch_file(settings);
+
+    for (;;) {
+      camera cam = m_camera;
+      bool quit = false;
+      bool restarted = false;
+      if (apply_settings(settings, cam, quit)) {
+        if (quit) {
+          return true;
+        }
+        if (!refine(cam, settings, restarted)) {
+          return false;
+        }
+      }
+
+      if (restarted) {
+        continue;
+      }
+      if (watch_path.empty()) {
+        return true;
+      }
+      while (!read_watch_file(settings)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      }
+    }
+  }
+
+ private:
+  camera          m_camera;
+  const hittable& m_world;
+
+  // Renders every level for cam, stopping early with restarted set when
+  // the watch file changes.
+  bool refine(camera& cam, std::string& settings, bool& restarted) {
+    timer since_start;
+    cam.initialize();
+    const int width = cam.image_width;
+    const int height = cam.image_height;
+
+    for (int scale = 8; scale > 1; scale /= 2) {
+      camera low = cam;
+      low.image_width = std::max(width / scale, 1);
+      low.samples_per_pixel = 1;
+      low.samples_per_pass = 1;
+      low.initialize();
+
+      render_state state(low.image_width, low.image_height, 0);
+      low.render_pass(0, 1, m_world, state);
+      if (!show(scale_up(state.resolve(), width, height), cam)) {
+        return false;
+      }
+      std::clog << "\rPreview at 1/" << scale << " width in "
+        << since_start.seconds() << " s\n";
+
+      if (read_watch_file(settings)) {
+        restarted = true;
+        return true;
+      }
+    }
+
+    // One sample per pass, so that the image is never long out of date.
+    const int passes = cam.samples_per_pixel;
+    cam.samples_per_pass = 1;
+    render_state state(width, height, 0);
+    timer since_shown;
+
+    for (int pass = 0; pass < passes; ++pass) {
+      cam.render_pass(pass, passes, m_world, state);
+
+      if (pass == 0 || pass + 1 == passes
+          || since_shown.seconds() >= update_interval) {
+        if (!show(state.resolve(), cam)) {
+          return false;
+        }
+        since_shown.reset();
+      }
+
+      if (read_watch_file(settings)) {
+        restarted = true;
+        return true;
+      }
+    }
+
+    std::clog << "\rPreview at " << passes << " spp in "
+      << since_start.seconds() << " s\n";
+    return true;
+  }
+
+  bool show(const framebuffer& image, const camera& cam) const {
+    if (cam.output_path.empty()) {
+      image.write(std::cout, cam.output_format);
+      std::cout.flush();
+      return static_cast<bool>(std::cout);
+    }
+
+    const std::string temporary = cam.output_path + ".tmp";
+    if (!image.save(temporary, cam.output_format)) {
+      return false;
+    }
+
+    // Windows does not rename over an existing file.
+    if (std::rename(temporary.c_str(), cam.output_path.c_str()) != 0) {
+      std::remove(cam.output_path.c_str());
+      if (std::rename(temporary.c_str(), cam.output_path.c_str()) != 0) {
+        std::cerr << "ERROR: Could not replace '" << cam.output_path
+          << "'\n";
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Nearest neighbour, so every low resolution pixel stays a sharp block.
+  static framebuffer scale_up(const framebuffer& low, int width, int height) {
+    framebuffer image(width, height);
+    for (int y = 0; y < height; ++y) {
+      const int low_y = std::min(y * low.height() / height, low.height() - 1);
+      for (int x = 0; x < width; ++x) {
+        const int low_x = std::min(x * low.width() / width, low.width() - 1);
+        image.at(x, y) = low.at(low_x, low_y);
+      }
+    }
+    return image;
+  }
+
+  // Reads the watch file into settings, returning whether it changed. A
+  // missing file reads as empty.
+  bool read_watch_file(std::string& settings) const {
+    if (watch_path.empty()) {
+      return false;
+    }
+    std::ifstream in(watch_path, std::ios::binary);
+    std::ostringstream contents;
+    if (in) {
+      contents << in.rdbuf();
+    }
+    if (contents.str() == settings) {
+      return false;
+    }
+    settings = contents.str();
+    return true;
+  }
+
+  // Applies the watch file to cam, reporting the first bad line.
+  bool apply_settings(const std::string& settings, camera& cam,
+                      bool& quit) const {
+    std::istringstream lines(settings);
+    std::string line;
+    for (int number = 1; std::getline(lines, line); ++number) {
+      std::istringstream in(line);
+      std::string key;
+      std::string error;
+      if (!(in >> key) || key[0] == '#') {
+        continue;
+      }
+      if (key == "quit") {
+        quit = true;
+        return true;
+      }
+      if (!read_camera_setting_line(key, in, cam, error)) {
+        std::cerr << "ERROR: " << watch_path << ":" << number << ": "
+          << error << "\n";
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+#endif  // _PREVIEW_H_
@@ -0,0 +1,453 @@
+#ifndef _PRIMITIVE_H_
+#define _PRIMITIVE_H_
+
+#include "rtweekend.h"
+#include "aabb.h"
+#include "hittable.h"
+
+#include <cstdint>
+#include <utility>
+
+// Plain data and intersection kernels for the closed set of primitive types
+// the renderer knows about. The hittable classes (sphere, quad, ...) wrap
+// these, and flat_bvh stores them by value and dispatches with a switch
+// instead of a virtual call. Kernels fill everything in hit_record except
+// the material.
+
+enum class primitive_type : uint32_t {
+  sphere,
+  moving_sphere,
+  quad,
+  triangle,
+  box,
+  instance,
+  medium,
+  external
+};
+
+struct primitive {
+  primitive_type type;
+  uint32_t       index;     // into the per-type array of the owner
+  uint32_t       material;  // into the material table of the owner
+};
+
+struct sphere_data {
+  point3 center;  // at time 0
+  vec3   motion;  // displacement of the center from time 0 to time 1
+  double radius;
+};
+
+struct quad_data {
+  point3 q;
+  vec3   u;
+  vec3   v;
+  vec3   w;
+  vec3   normal;
+  double d;
+};
+
+struct box_data {
+  point3 min;
+  point3 max;
+};
+
+// Rotation about the y axis followed by a translation, applied to a child.
+struct instance_data {
+  vec3     offset;
+  double   sin_theta;
+  double   cos_theta;
+  uint32_t child;
+};
+
+struct medium_data {
+  double   neg_inv_density;
+  uint32_t boundary;
+};
+
+inline void get_sphere_uv(const point3& p, double& u, double& v) {
+  const double theta = std::acos(-p.y());
+  const double phi = std::atan2(-p.z(), p.x()) + pi;
+
+  u = phi / (2.0 * pi);
+  v = theta / pi;
+}
+
+inline quad_data make_quad_data(const point3& q, const vec3& u, const vec3& v) {
+  quad_data data;
+  const vec3 n = cross(u, v);
+  data.q = q;
+  data.u = u;
+  data.v = v;
+  data.normal = unit_vector(n);
+  data.d = dot(data.normal, q);
+  data.w = n / dot(n, n);
+  return data;
+}
+
+inline aabb sphere_bounds(const sphere_data& s) {
+  const vec3 rvec = vec3(s.radius, s.radius, s.radius);
+  const aabb box0(s.center - rvec, s.center + rvec);
+  const aabb box1(s.center + s.motion - rvec, s.center + s.motion + rvec);
+  return aabb(box0, box1);
+}
+
+inline aabb quad_bounds(const quad_data& q) {
+  const aabb bbox_diagonal1 = aabb(q.q, q.q + q.u + q.v);
+  const aabb bbox_diagonal2 = aabb(q.q + q.u, q.q + q.v);
+  return aabb(bbox_diagonal1, bbox_diagonal2);
+}
+
+inline aabb triangle_bounds(const quad_data& q) {
+  return aabb(aabb(q.q, q.q + q.u), aabb(q.q, q.q + q.v));
+}
+
+inline box_data make_box_data(const point3& a, const point3& b) {
+  return {
+    point3(fmin(a.x(), b.x()), fmin(a.y(), b.y()), fmin(a.z(), b.z())),
+    point3(fmax(a.x(), b.x()), fmax(a.y(), b.y()), fmax(a.z(), b.z()))
+  };
+}
+
+inline aabb box_bounds(const box_data& b) {
+  return aabb(b.min, b.max);
+}
+
+inline bool hit_sphere(
+  const sphere_data& s,
+  bool moving,
+  const ray& r,
+  interval ray_t,
+  hit_record& rec) {
+  const point3 center = moving ? s.center + r.time() * s.motion : s.center;
+  const vec3 oc = center - r.origin();
+  const double a = r.direction().length_squared();
+  const double h = dot(r.direction(), oc);
+  const double c = oc.length_squared() - s.radius * s.radius;
+
+  const double discriminant = h * h - a * c;
+
+  if (discriminant < 0.0) {
+    return false;
+  }
+
+  const double sqrtd = std::sqrt(discriminant);
+
+  double root = (h - sqrtd) / a;
+  if (!ray_t.surrounds(root)) {
+    root = (h + sqrtd) / a;
+    if (!ray_t.surrounds(root)) {
+      return false;
+    }
+  }
+
+  rec.t = root;
+  rec.p = r.at(rec.t);
+  const vec3 outward_normal = (rec.p - center) / s.radius;
+  rec.set_face_normal(r, outward_normal);
+  get_sphere_uv(outward_normal, rec.u, rec.v);
+  rec.set_footprint(r, 1.0 / (2.0 * pi * s.radius));
+
+  return true;
+}
+
+// Both roots of the sphere along the ray's line.
+inline bool sphere_interval(
+  const sphere_data& s,
+  bool moving,
+  const ray& r,
+  interval& span) {
+  const point3 center = moving ? s.center + r.time() * s.motion : s.center;
+  const vec3 oc = center - r.origin();
+  const double a = r.direction().length_squared();
+  const double h = dot(r.direction(), oc);
+  const double c = oc.length_squared() - s.radius * s.radius;
+
+  const double discriminant = h * h - a * c;
+  if (discriminant < 0.0) {
+    return false;
+  }
+
+  const double sqrtd = std::sqrt(discriminant);
+  span = interval((h - sqrtd) / a, (h + sqrtd) / a);
+  return true;
+}
+
+// Intersects the plane of a quad or triangle, returning the hit distance and
+// the planar coordinates of the hit point along u and v.
+inline bool hit_plane(
+  const quad_data& q,
+  const ray& r,
+  interval ray_t,
+  double& t,
+  double& alpha,
+  double& beta) {
+  const double denom = dot(q.normal, r.direction());
+
+  if (fabs(denom) < 1e-8) {
+    return false;
+  }
+
+  t = (q.d - dot(q.normal, r.origin())) / denom;
+  if (!ray_t.contains(t)) {
+    return false;
+  }
+
+  const vec3 planar_hitpt_vector = r.at(t) - q.q;
+  alpha = dot(q.w, cross(planar_hitpt_vector, q.v));
+  beta = dot(q.w, cross(q.u, planar_hitpt_vector));
+  return true;
+}
+
+// uv units per unit of distance on a quad or triangle, the inverse square
+// root of its area, |w| being the inverse of the area.
+inline double plane_uv_per_unit(const quad_data& q) {
+  return std::sqrt(q.w.length());
+}
+
+inline void set_plane_hit(
+  const quad_data& q,
+  const ray& r,
+  double t,
+  double alpha,
+  double beta,
+  hit_record& rec) {
+  rec.t = t;
+  rec.p = r.at(t);
+  rec.u = alpha;
+  rec.v = beta;
+  rec.set_face_normal(r, q.normal);
+  rec.set_footprint(r, plane_uv_per_unit(q));
+}
+
+inline bool hit_quad(
+  const quad_data& q,
+  const ray& r,
+  interval ray_t,
+  hit_record& rec) {
+  double t, alpha, beta;
+  if (!hit_plane(q, r, ray_t, t, alpha, beta)) {
+    return false;
+  }
+
+  const interval unit_interval = interval(0.0, 1.0);
+  if (!unit_interval.contains(alpha) || !unit_interval.contains(beta)) {
+    return false;
+  }
+
+  set_plane_hit(q, r, t, alpha, beta, rec);
+  return true;
+}
+
+inline bool hit_triangle(
+  const quad_data& q,
+  const ray& r,
+  interval ray_t,
+  hit_record& rec) {
+  double t, alpha, beta;
+  if (!hit_plane(q, r, ray_t, t, alpha, beta)) {
+    return false;
+  }
+
+  if (alpha < 0.0 || beta < 0.0 || alpha + beta > 1.0) {
+    return false;
+  }
+
+  set_plane_hit(q, r, t, alpha, beta, rec);
+  return true;
+}
+
+// Entry and exit of the ray's line through the box slabs.
+inline bool box_interval(const box_data& b, const ray& r, interval& span) {
+  const point3& o = r.origin();
+  const vec3& d = r.direction();
+
+  double t_near = -infinity;
+  double t_far = infinity;
+  for (int axis = 0; axis < 3; ++axis) {
+    const double inv = 1.0 / d[axis];
+    double t0 = (b.min[axis] - o[axis]) * inv;
+    double t1 = (b.max[axis] - o[axis]) * inv;
+    if (t0 > t1) {
+      std::swap(t0, t1);
+    }
+    t_near = fmax(t_near, t0);
+    t_far = fmin(t_far, t1);
+  }
+
+  if (t_far < t_near) {
+    return false;
+  }
+
+  span = interval(t_near, t_far);
+  return true;
+}
+
+// Slab test against an axis aligned box. The ray hits the face it enters
+// through, or the face it leaves through when it starts inside. The uv of
+// each face follow the quads box() used to build, so textures map the same.
+inline bool hit_box(
+  const box_data& b,
+  const ray& r,
+  interval ray_t,
+  hit_record& rec) {
+  const point3& o = r.origin();
+  const vec3& d = r.direction();
+
+  double t_near = -infinity;
+  double t_far = infinity;
+  int near_axis = 0;
+  int far_axis = 0;
+
+  for (int axis = 0; axis < 3; ++axis) {
+    const double inv = 1.0 / d[axis];
+    double t0 = (b.min[axis] - o[axis]) * inv;
+    double t1 = (b.max[axis] - o[axis]) * inv;
+    if (t0 > t1) {
+      std::swap(t0, t1);
+    }
+
+    if (t0 > t_near) {
+      t_near = t0;
+      near_axis = axis;
+    }
+    if (t1 < t_far) {
+      t_far = t1;
+      far_axis = axis;
+    }
+  }
+
+  if (t_far < t_near) {
+    return false;
+  }
+
+  double t;
+  int axis;
+  double side;
+  if (ray_t.contains(t_near)) {
+    t = t_near;
+    axis = near_axis;
+    side = d[axis] < 0.0 ? 1.0 : -1.0;
+  } else if (ray_t.contains(t_far)) {
+    t = t_far;
+    axis = far_axis;
+    side = d[axis] < 0.0 ? -1.0 : 1.0;
+  } else {
+    return false;
+  }
+
+  rec.t = t;
+  rec.p = r.at(t);
+
+  vec3 outward_normal(0.0, 0.0, 0.0);
+  outward_normal[axis] = side;
+  rec.set_face_normal(r, outward_normal);
+
+  const vec3 local = rec.p - b.min;
+  const vec3 size = b.max - b.min;
+  if (axis == 0) {
+    const double z = local.z() / size.z();
+    rec.u = side > 0.0 ? 1.0 - z : z;
+    rec.v = local.y() / size.y();
+    rec.set_footprint(r, 1.0 / std::sqrt(size.y() * size.z()));
+  } else if (axis == 1) {
+    const double z = local.z() / size.z();
+    rec.u = local.x() / size.x();
+    rec.v = side > 0.0 ? 1.0 - z : z;
+    rec.set_footprint(r, 1.0 / std::sqrt(size.x() * size.z()));
+  } else {
+    const double x = local.x() / size.x();
+    rec.u = side > 0.0 ? x : 1.0 - x;
+    rec.v = local.y() / size.y();
+    rec.set_footprint(r, 1.0 / std::sqrt(size.x() * size.y()));
+  }
+
+  return true;
+}
+
+// The ray in the instance's local frame. Distances along the ray are the
+// same in both frames.
+inline ray instance_ray(const instance_data& inst, const ray& r) {
+  const double s = inst.sin_theta;
+  const double c = inst.cos_theta;
+
+  const point3 o = r.origin() - inst.offset;
+  const vec3& d = r.direction();
+  ray local_r(
+    point3(c * o[0] - s * o[2], o[1], s * o[0] + c * o[2]),
+    vec3(c * d[0] - s * d[2], d[1], s * d[0] + c * d[2]),
+    r.time());
+  local_r.set_cone(r.cone_width(), r.cone_spread());
+  return local_r;
+}
+
+template <typename Child>
+bool hit_instance(
+  const instance_data& inst,
+  const Child& child,
+  const ray& r,
+  interval ray_t,
+  hit_record& rec) {
+  if (!child.hit(instance_ray(inst, r), ray_t, rec)) {
+    return false;
+  }
+
+  const double s = inst.sin_theta;
+  const double c = inst.cos_theta;
+
+  const point3 p = rec.p;
+  rec.p = point3(c * p[0] + s * p[2], p[1], -s * p[0] + c * p[2])
+    + inst.offset;
+
+  const vec3 n = rec.normal;
+  rec.normal = vec3(c * n[0] + s * n[2], n[1], -s * n[0] + c * n[2]);
+
+  return true;
+}
+
+// Finds where the ray enters and leaves the boundary with one interval
+// query and samples a scattering distance inside it.
+template <typename Boundary>
+bool hit_medium(
+  const Boundary& boundary,
+  double neg_inv_density,
+  const ray& r,
+  interval ray_t,
+  hit_record& rec) {
+  interval span;
+  if (!boundary.hit_interval(r, span)) {
+    return false;
+  }
+
+  if (span.min < ray_t.min) {
+    span.min = ray_t.min;
+  }
+  if (span.max > ray_t.max) {
+    span.max = ray_t.max;
+  }
+
+  if (span.min >= span.max) {
+    return false;
+  }
+
+  if (span.min < 0.0) {
+    span.min = 0.0;
+  }
+
+  const double ray_length = r.direction().length();
+  const double distance_inside_boundary = span.size() * ray_length;
+  const double hit_distance = neg_inv_density * log(random_double());
+
+  if (hit_distance > distance_inside_boundary) {
+    return false;
+  }
+
+  rec.t = span.min + hit_distance / ray_length;
+  rec.p = r.at(rec.t);
+  rec.normal = vec3(1.0, 0.0, 0.0);
+  rec.front_face = true;
+  rec.footprint = 0.0;
+
+  return true;
+}
+
+#endif  // _PRIMITIVE_H_
@@ -4,6 +4,7 @@
 #include "hittable_list.h"
 #include "rtweekend.h"
 #include "hittable.h"
+#include "primitive.h"
 
 class quad : public hittable {
  public:
@@ -12,49 +13,31 @@ class quad : public hittable {
     const vec3& u,
     const vec3 v,
     std::shared_ptr<material> mat)
-  : m_q(q), m_u(u), m_v(v), m_mat(mat) {
-    const vec3 n = cross(u, v);
-    m_normal = unit_vector(n);
-    m_d = dot(m_normal, m_q);
-    m_w = n / dot(n, n);
-
+  : m_data(make_quad_data(q, u, v)), m_mat(mat) {
     set_bounding_box();
   }
 
   virtual void set_bounding_box() {
-    const aabb bbox_diagonal1 = aabb(m_q, m_q + m_u + m_v);
-    const aabb bbox_diagonal2 = aabb(m_q + m_u, m_q + m_v);
-
-    m_bbox = aabb(bbox_diagonal1, bbox_diagonal2);
+    m_bbox = quad_bounds(m_data);
   }
 
   aabb bounding_box() const override { return m_bbox; }
 
   bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
-    const double denom = dot(m_normal, r.direction());
-
-    if (fabs(denom) < 1e-8) {
+    double t, alpha, beta;
+    if (!hit_plane(m_data, r, ray_t, t, alpha, beta)) {
       return false;
     }
 
-    const double t = (m_d - dot(m_normal, r.origin())) / denom;
-    if (!ray_t.contains(t)) {
-      return false;
-    }
-
-    const point3 intersection = r.at(t);
-    const vec3 planar_hitpt_vector = intersection - m_q;
-    const double alpha = dot(m_w, cross(planar_hitpt_vector, m_v));
-    const double beta = dot(m_w, cross(m_u, planar_hitpt_vector));
-
     if(!is_interior(alpha, beta, rec)) {
       return false;
     }
 
     rec.t = t;
-    rec.p = intersection;
+    rec.p = r.at(t);
     rec.mat = m_mat;
-    rec.set_face_normal(r, m_normal);
+    rec.set_face_normal(r, m_data.normal);
+    rec.set_footprint(r, plane_uv_per_unit(m_data));
 
     return true;
   }
@@ -71,54 +54,13 @@ class quad : public hittable {
     return true;
   }
 
+  const quad_data& data() const { return m_data; }
+  const std::shared_ptr<material>& mat() const { return m_mat; }
+
  private:
-  point3 m_q;
-  vec3 m_u;
-  vec3 m_v;
-  vec3 m_w;
+  quad_data m_data;
   std::shared_ptr<material> m_mat;
   aabb m_bbox;
-  vec3 m_normal;
-  double m_d;
 };
 
-inline std::shared_ptr<hittable_list> box(
-  const point3&a, const point3& b, std::shared_ptr<material> mat) {
-  std::shared_ptr<hittable_list> sides = std::make_shared<hittable_list>();
-
-  const point3 min = point3(
-    fmin(a.x(), b.x()),
-    fmin(a.y(), b.y()),
-    fmin(a.z(), b.z()));
-  const point3 max = point3(
-    fmax(a.x(), b.x()),
-    fmax(a.y(), b.y()),
-    fmax(a.z(), b.z()));
-
-  const vec3 dx = vec3(max.x() - min.x(), 0.0, 0.0);
-  const vec3 dy = vec3(0.0, max.y() - min.y(), 0.0);
-  const vec3 dz = vec3(0.0, 0.0, max.z() - min.z());
-
-  sides->add(
-    std::make_shared<quad>(
-      point3(min.x(), min.y(), max.z()), dx, dy, mat));
-  sides->add(
-    std::make_shared<quad>(
-      point3(max.x(), min.y(), max.z()), -dz, dy, mat));
-  sides->add(
-    std::make_shared<quad>(
-      point3(max.x(), min.y(), min.z()), -dx, dy, mat));
-  sides->add(
-    std::make_shared<quad>(
-      point3(min.x(), min.y(), min.z()), dz, dy, mat));
-  sides->add(
-    std::make_shared<quad>(
-      point3(min.x(), max.y(), max.z()), dx, -dz, mat));
-  sides->add(
-    std::make_shared<quad>(
-      point3(min.x(), min.y(), min.z()), dx, dz, mat));
-
-  return sides;
-}
-
 #endif  // _QUAD_H_
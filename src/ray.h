@@ -21,10 +21,27 @@ class ray {
     return m_origin + t * m_dir;
   }
 
+  // Ray cone used to estimate texture footprints. The cone is cone_width
+  // wide at the origin and widens by cone_spread per unit of distance.
+  // Rays without a cone are point samples.
+  double cone_width() const { return m_cone_width; }
+  double cone_spread() const { return m_cone_spread; }
+
+  void set_cone(double width, double spread) {
+    m_cone_width = width;
+    m_cone_spread = spread;
+  }
+
+  double width_at(double t) const {
+    return m_cone_width + m_cone_spread * t * m_dir.length();
+  }
+
  private:
   point3 m_origin;
   vec3 m_dir;
   double m_time;
+  double m_cone_width = 0.0;
+  double m_cone_spread = 0.0;
 };
 
 #endif  // _RAY_H_
@@ -0,0 +1,140 @@
+#ifndef _RAY_PACKET_H_
+#define _RAY_PACKET_H_
+
+#include "rtweekend.h"
+#include "aabb.h"
+
+// A small group of coherent rays (neighbouring camera rays) that is traced
+// through the BVH together. Besides the rays themselves the packet keeps the
+// bounds of their origins and inverse directions, so a whole BVH node can be
+// rejected with a single interval-arithmetic slab test.
+class ray_packet {
+ public:
+  static const int max_size = 8;
+  // Below this many live rays the packet is considered diverged and the
+  // remaining rays continue with single-ray traversal.
+  static const int min_active = 3;
+
+  ray      rays[max_size];
+  interval ray_t[max_size];
+  int      size     = 0;
+  unsigned hit_mask = 0;
+
+  void add(const ray& r, const interval& t) {
+    rays[size] = r;
+    ray_t[size] = t;
+    ++size;
+  }
+
+  unsigned all() const { return (1u << size) - 1u; }
+
+  bool is_active(unsigned mask, int i) const { return (mask >> i) & 1u; }
+
+  static int count(unsigned mask) {
+    int n = 0;
+    for (; mask != 0u; mask &= mask - 1u) {
+      ++n;
+    }
+    return n;
+  }
+
+  void prepare() {
+    m_coherent = size > 0;
+    m_t_min = infinity;
+    for (int i = 0; i < size; ++i) {
+      if (ray_t[i].min < m_t_min) m_t_min = ray_t[i].min;
+    }
+
+    for (int axis = 0; axis < 3; ++axis) {
+      m_origin[axis] = interval::empty;
+      m_inv_dir[axis] = interval::empty;
+
+      for (int i = 0; i < size; ++i) {
+        const double o = rays[i].origin()[axis];
+        const double inv = 1.0 / rays[i].direction()[axis];
+        m_ray_inv_dir[i][axis] = inv;
+        m_origin[axis] = interval(m_origin[axis], interval(o, o));
+        m_inv_dir[axis] = interval(m_inv_dir[axis], interval(inv, inv));
+      }
+
+      // Interval arithmetic only bounds the slab distances when every ray
+      // crosses the slab in the same direction.
+      const interval& inv = m_inv_dir[axis];
+      const bool same_sign = inv.min > 0.0 || inv.max < 0.0;
+      if (!same_sign || std::isinf(inv.min) || std::isinf(inv.max)) {
+        m_coherent = false;
+      }
+      m_positive[axis] = inv.min > 0.0;
+    }
+  }
+
+  bool coherent() const { return m_coherent; }
+
+  const vec3& inv_dir(int i) const { return m_ray_inv_dir[i]; }
+
+  // Conservative test: false means none of the active rays can hit the box.
+  bool may_hit(const aabb& box, unsigned active) const {
+    double t_near = m_t_min;
+    double t_far = -infinity;
+    for (int i = 0; i < size; ++i) {
+      if (is_active(active, i) && ray_t[i].max > t_far) {
+        t_far = ray_t[i].max;
+      }
+    }
+
+    for (int axis = 0; axis < 3; ++axis) {
+      const interval& slab = box.axis_interval(axis);
+      const interval& o = m_origin[axis];
+      const interval& inv = m_inv_dir[axis];
+
+      // With the sign of the reciprocal direction fixed, the interval
+      // products reduce to picking the right endpoints.
+      double near_t, far_t;
+      if (m_positive[axis]) {
+        const double near_lo = slab.min - o.max;
+        const double far_hi = slab.max - o.min;
+        near_t = near_lo * (near_lo >= 0.0 ? inv.min : inv.max);
+        far_t = far_hi * (far_hi >= 0.0 ? inv.max : inv.min);
+      } else {
+        const double near_hi = slab.max - o.min;
+        const double far_lo = slab.min - o.max;
+        near_t = near_hi * (near_hi >= 0.0 ? inv.min : inv.max);
+        far_t = far_lo * (far_lo >= 0.0 ? inv.max : inv.min);
+      }
+
+      if (near_t > t_near) t_near = near_t;
+      if (far_t < t_far) t_far = far_t;
+
+      if (t_far <= t_near) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  // Exact per-ray slab test, returns the subset of active rays hitting box.
+  unsigned hitting(const aabb& box, unsigned active) const {
+    unsigned result = 0u;
+    for (int i = 0; i < size; ++i) {
+      if (is_active(active, i)
+          && box.hit(rays[i].origin(), m_ray_inv_dir[i], ray_t[i])) {
+        result |= 1u << i;
+      }
+    }
+    return result;
+  }
+
+ private:
+  interval m_origin[3];
+  interval m_inv_dir[3];
+  bool     m_positive[3];
+  bool     m_coherent = false;
+  double   m_t_min;
+  vec3     m_ray_inv_dir[max_size];
+};
+
+const int ray_packet::max_size;
+const int ray_packet::min_active;
+
+#endif  // _RAY_PACKET_H_
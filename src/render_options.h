@@ -0,0 +1,378 @@
+#ifndef _RENDER_OPTIONS_H_
+#define _RENDER_OPTIONS_H_
+
+#include "rtweekend.h"
+#include "binary_scene.h"
+#include "camera.h"
+#include "distributed.h"
+#include "framebuffer.h"
+#include "hittable.h"
+#include "preview.h"
+#include "render_server.h"
+#include "wavefront.h"
+
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Render settings from the command line. A scene sets up its camera as
+// before, then these override whatever was given; numbers left at zero (or
+// -1 for the depth) keep the scene's own value. Everything is applied once
+// before rendering starts, so the per-sample code is the same as without
+// them.
+class render_options {
+ public:
+  std::string  scene             = "final_scene";
+  // Rendered instead of scene when given.
+  std::string  scene_file;
+  // Writes the scene here in the binary format instead of rendering it.
+  std::string  convert_path;
+  int          image_width       = 0;
+  int          samples_per_pixel = 0;
+  int          max_depth         = -1;
+  // Zero uses every hardware thread.
+  int          threads           = 0;
+  std::string  output_path;
+  image_format output_format     = image_format::ppm;
+  std::string  checkpoint_path;
+  int          checkpoint_interval = 60;
+  bool         resume            = false;
+  // Zero keeps the camera's own values.
+  int          time_budget       = 0;
+  int          samples_per_pass  = 0;
+  // Forks this many render processes when more than one.
+  int          processes         = 1;
+  // Renders only share_index of share_count (counted from zero) and saves
+  // its samples to output_path, when share_count is set.
+  int          share_index       = 0;
+  int          share_count       = 0;
+  // Shares to add up into the output image instead of rendering.
+  std::vector<std::string> merge_paths;
+  // Serves render jobs on this socket instead of rendering once.
+  std::string  serve_path;
+  // Renders a progressive preview, restarted whenever watch_path changes.
+  bool         preview           = false;
+  std::string  watch_path;
+  bool         packets           = false;
+  bool         wavefront         = false;
+  bool         sort_rays         = false;
+  bool         sort_materials    = false;
+  bool         list_scenes       = false;
+  // Measures baked noise volumes against direct evaluation and exits.
+  bool         noise_report      = false;
+  // Times perlin against the noise kernel of the books and exits.
+  bool         bench_noise       = false;
+  bool         help              = false;
+
+  static void usage(std::ostream& out, const char* program) {
+    out << "Usage: " << program << " [options]\n"
+      "  --scene NAME|N        scene to render, by name or number"
+      " (default final_scene)\n"
+      "  --scene-file PATH     render the scene described in PATH\n"
+      "  --convert PATH        write the scene to PATH as a binary scene\n"
+      "                        file instead of rendering it\n"
+      "  --list                list the scenes and exit\n"
+      "  --noise-report        compare baked noise textures of several\n"
+      "                        resolutions with direct evaluation and exit\n"
+      "  --bench-noise         time the noise kernel against the one of the\n"
+      "                        books and exit\n"
+      "  --width N             image width in pixels\n"
+      "  --spp N               samples per pixel\n"
+      "  --depth N             maximum bounces per path\n"
+      "  --threads N           render threads, 0 for all cores (default)\n"
+      "  -o, --output PATH     write the image to PATH instead of stdout\n"
+      "  --format FORMAT       ppm, ppm-binary or pfm (default ppm, or pfm\n"
+      "                        for a .pfm output path)\n"
+      "  --time-budget SECONDS render whole passes until the time is up,\n"
+      "                        with --spp as the most samples per pixel\n"
+      "  --pass-samples N      samples per pixel added by each pass\n"
+      "                        (default 16, or 1 with --time-budget and no\n"
+      "                        --checkpoint)\n"
+      "  --checkpoint PATH     save the render progress to PATH now and then\n"
+      "  --checkpoint-interval SECONDS\n"
+      "                        time between checkpoints (default 60)\n"
+      "  --resume              continue the render saved in the checkpoint\n"
+      "  --processes N         split the render between N processes\n"
+      "  --share K/N           render share K of N and save its samples to\n"
+      "                        the output path\n"
+      "  --merge PATH          add up the samples saved by --share into the\n"
+      "                        output image, repeated for every share\n"
+      "  --serve SOCKET        keep the scene loaded and render the jobs\n"
+      "                        sent to the UNIX socket SOCKET\n"
+      "  --preview             render at 1/8, 1/4 and 1/2 of the width,\n"
+      "                        then refine, rewriting the image as it goes\n"
+      "  --watch PATH          preview: camera settings to restart with\n"
+      "                        whenever PATH changes\n"
+      "  --packets             trace primary rays in packets\n"
+      "  --wavefront           render breadth first, single threaded\n"
+      "  --sort-rays           wavefront: reorder rays before each bounce\n"
+      "  --sort-materials      wavefront: group hits by material\n"
+      "  -h, --help            show this message\n";
+  }
+
+  // Reads the arguments, reporting the first bad one to err.
+  bool parse(int argc, char** argv, std::ostream& err) {
+    bool format_given = false;
+    bool threads_given = false;
+
+    for (int i = 1; i < argc; ++i) {
+      const std::string arg = argv[i];
+      const bool has_value = i + 1 < argc;
+
+      if (arg == "-h" || arg == "--help") {
+        help = true;
+      } else if (arg == "--list") {
+        list_scenes = true;
+      } else if (arg == "--noise-report") {
+        noise_report = true;
+      } else if (arg == "--bench-noise") {
+        bench_noise = true;
+      } else if (arg == "--packets") {
+        packets = true;
+      } else if (arg == "--wavefront") {
+        wavefront = true;
+      } else if (arg == "--sort-rays") {
+        sort_rays = true;
+      } else if (arg == "--sort-materials") {
+        sort_materials = true;
+      } else if (arg == "--preview") {
+        preview = true;
+      } else if (arg == "--resume") {
+        resume = true;
+      } else if (!has_value) {
+        err << "ERROR: Unknown option or missing value '" << arg << "'\n";
+        return false;
+      } else if (arg == "--scene") {
+        scene = argv[++i];
+      } else if (arg == "--scene-file") {
+        scene_file = argv[++i];
+      } else if (arg == "--convert") {
+        convert_path = argv[++i];
+      } else if (arg == "--width") {
+        if (!parse_int(arg, argv[++i], 1, image_width, err)) return false;
+      } else if (arg == "--spp") {
+        if (!parse_int(arg, argv[++i], 1, samples_per_pixel, err)) {
+          return false;
+        }
+      } else if (arg == "--depth") {
+        if (!parse_int(arg, argv[++i], 0, max_depth, err)) return false;
+      } else if (arg == "--threads") {
+        if (!parse_int(arg, argv[++i], 0, threads, err)) return false;
+        threads_given = true;
+      } else if (arg == "-o" || arg == "--output") {
+        output_path = argv[++i];
+      } else if (arg == "--time-budget") {
+        if (!parse_int(arg, argv[++i], 1, time_budget, err)) return false;
+      } else if (arg == "--pass-samples") {
+        if (!parse_int(arg, argv[++i], 1, samples_per_pass, err)) {
+          return false;
+        }
+      } else if (arg == "--processes") {
+        if (!parse_int(arg, argv[++i], 1, processes, err)) return false;
+      } else if (arg == "--share") {
+        if (!parse_share(argv[++i], err)) return false;
+      } else if (arg == "--merge") {
+        merge_paths.push_back(argv[++i]);
+      } else if (arg == "--watch") {
+        watch_path = argv[++i];
+      } else if (arg == "--serve") {
+        serve_path = argv[++i];
+      } else if (arg == "--checkpoint") {
+        checkpoint_path = argv[++i];
+      } else if (arg == "--checkpoint-interval") {
+        if (!parse_int(arg, argv[++i], 0, checkpoint_interval, err)) {
+          return false;
+        }
+      } else if (arg == "--format") {
+        if (!parse_image_format(argv[++i], output_format)) {
+          err << "ERROR: Unknown image format '" << argv[i] << "'\n";
+          return false;
+        }
+        format_given = true;
+      } else {
+        err << "ERROR: Unknown option '" << arg << "'\n";
+        return false;
+      }
+    }
+
+    if (resume && checkpoint_path.empty()) {
+      err << "ERROR: --resume needs --checkpoint\n";
+      return false;
+    }
+
+    // The wavefront renderer has no passes and a single thread.
+    if (wavefront && (!checkpoint_path.empty() || time_budget > 0
+                      || samples_per_pass > 0 || threads_given)) {
+      err << "ERROR: --wavefront cannot be combined with --checkpoint, "
+        "--resume, --time-budget, --pass-samples or --threads\n";
+      return false;
+    }
+
+    if (processes > 1 && (wavefront || share_count > 0
+                          || !checkpoint_path.empty())) {
+      err << "ERROR: --processes cannot be combined with --wavefront, "
+        "--share or --checkpoint\n";
+      return false;
+    }
+
+    if (share_count > 0 && (wavefront || output_path.empty())) {
+      err << "ERROR: --share needs --output and cannot be combined with "
+        "--wavefront\n";
+      return false;
+    }
+
+    if (!serve_path.empty() && (wavefront || processes > 1
+                                || share_count > 0
+                                || !checkpoint_path.empty())) {
+      err << "ERROR: --serve cannot be combined with --wavefront, "
+        "--processes, --share or --checkpoint\n";
+      return false;
+    }
+
+    if (!watch_path.empty() && !preview) {
+      err << "ERROR: --watch needs --preview\n";
+      return false;
+    }
+
+    // The preview sets its own pass size and runs until full quality.
+    if (preview && (wavefront || processes > 1 || share_count > 0
+                    || !serve_path.empty() || !checkpoint_path.empty()
+                    || time_budget > 0 || samples_per_pass > 0)) {
+      err << "ERROR: --preview cannot be combined with --wavefront, "
+        "--processes, --share, --serve, --checkpoint, --time-budget or "
+        "--pass-samples\n";
+      return false;
+    }
+
+    if (!format_given && ends_with(output_path, ".pfm")) {
+      output_format = image_format::pfm;
+    }
+    return true;
+  }
+
+  void apply(camera& cam) const {
+    if (image_width > 0) cam.image_width = image_width;
+    if (samples_per_pixel > 0) cam.samples_per_pixel = samples_per_pixel;
+    if (max_depth >= 0) cam.max_depth = max_depth;
+    cam.threads = threads;
+    cam.output_path = output_path;
+    cam.output_format = output_format;
+    cam.checkpoint_path = checkpoint_path;
+    cam.checkpoint_interval = checkpoint_interval;
+    cam.resume = resume;
+    if (time_budget > 0) cam.time_budget = time_budget;
+    if (samples_per_pass > 0) {
+      cam.samples_per_pass = samples_per_pass;
+    } else if (time_budget > 0 && checkpoint_path.empty()) {
+      // The first pass always runs, so it has to be short for a small
+      // budget on a heavy scene. A checkpoint keeps the usual pass size,
+      // which is part of its settings, so that a run without a budget can
+      // continue it.
+      cam.samples_per_pass = 1;
+    }
+    if (packets) cam.packet_traversal = true;
+  }
+
+  // Applies the options and renders with the renderer they select.
+  void render(camera& cam, const hittable& world) const {
+    apply(cam);
+
+    if (!convert_path.empty()) {
+      if (binary_scene::write(convert_path, cam, world, std::cerr)) {
+        std::clog << "Wrote " << convert_path << "\n";
+      } else {
+        m_failed = true;
+      }
+      return;
+    }
+
+    if (wavefront) {
+      wavefront_renderer renderer(cam);
+      renderer.sort_rays = sort_rays;
+      renderer.sort_by_material = sort_materials;
+      if (!renderer.render(world)) {
+        m_failed = true;
+      }
+      return;
+    }
+
+    bool rendered = false;
+    if (preview) {
+      preview_renderer renderer(cam, world);
+      renderer.watch_path = watch_path;
+      rendered = renderer.render();
+    } else if (!serve_path.empty()) {
+      rendered = render_server(cam, world, output_format).serve(serve_path);
+    } else if (share_count > 0) {
+      rendered = distributed_renderer(cam).render_share(
+        world, share_index, share_count);
+    } else if (processes > 1) {
+      rendered = distributed_renderer(cam).render(world, processes);
+    } else {
+      rendered = cam.render(world);
+    }
+    if (!rendered) {
+      m_failed = true;
+    }
+  }
+
+  // Writes the image made of the shares in merge_paths.
+  bool merge() const {
+    return distributed_renderer::merge(
+      merge_paths, output_path, output_format, std::cerr);
+  }
+
+  // Whether a render() call could not do its job.
+  bool failed() const { return m_failed; }
+
+ private:
+  mutable bool m_failed = false;
+
+  static bool parse_int(
+    const std::string& name, const char* text, int min, int& value,
+    std::ostream& err) {
+    char* end = nullptr;
+    errno = 0;
+    const long parsed = std::strtol(text, &end, 10);
+    if (end == text || *end != '\0' || errno == ERANGE
+        || parsed < min || parsed > INT_MAX) {
+      err << "ERROR: " << name << " needs an integer of at least " << min
+          << ", got '" << text << "'\n";
+      return false;
+    }
+    value = static_cast<int>(parsed);
+    return true;
+  }
+
+  // K/N with 1 <= K <= N.
+  bool parse_share(const char* text, std::ostream& err) {
+    const std::string value = text;
+    const size_t slash = value.find('/');
+    int k = 0;
+    int n = 0;
+    std::ostringstream ignored;
+    if (slash == std::string::npos
+        || !parse_int("--share", value.substr(0, slash).c_str(), 1, k,
+                      ignored)
+        || !parse_int("--share", value.substr(slash + 1).c_str(), 1, n,
+                      ignored)
+        || k > n) {
+      err << "ERROR: --share needs K/N with 1 <= K <= N, got '" << text
+        << "'\n";
+      return false;
+    }
+    share_index = k - 1;
+    share_count = n;
+    return true;
+  }
+
+  static bool ends_with(const std::string& s, const std::string& suffix) {
+    return s.size() >= suffix.size()
+      && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+  }
+};
+
+#endif  // _RENDER_OPTIONS_H_
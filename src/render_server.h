@@ -0,0 +1,276 @@
+#ifndef _RENDER_SERVER_H_
+#define _RENDER_SERVER_H_
+
+#include "rtweekend.h"
+#include "camera.h"
+#include "camera_settings.h"
+#include "framebuffer.h"
+#include "hittable.h"
+#include "render_state.h"
+#include "timer.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <ostream>
+#include <sstream>
+#include <string>
+
+#ifndef _WIN32
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+// Keeps a built scene in memory and renders the jobs sent to a local
+// socket, so a job costs only its render time. A client connects and sends
+// settings one per line, with the keys of a scene file's camera statement:
+//
+//   lookfrom 13 2 3
+//   vfov 30
+//   spp 64
+//
+// then "render", or just closes its side. It may also ask for a "format"
+// (ppm, ppm-binary or pfm). The server sends back the image, or a line
+// starting with "ERROR:", and closes the connection. "quit" stops the
+// server. Clients are served one at a time, so one that sends nothing for
+// receive_timeout seconds gets an error instead of holding up the others,
+// and so does a job of more than max_pixels, or one that runs out of
+// memory, instead of taking the server down.
+//
+// Every job starts from the scene's own camera. A job that only asks for
+// more samples than the one before it continues that render instead of
+// starting over, when the earlier render ended on a whole pass.
+class render_server {
+ public:
+  int     receive_timeout = 10;
+  int64_t max_pixels      = static_cast<int64_t>(8192) * 8192;
+
+  render_server(const camera& cam, const hittable& world,
+                image_format format)
+  : m_camera(cam), m_world(world), m_format(format) {}
+
+  // Returns false if the socket cannot be set up.
+  bool serve(const std::string& socket_path) {
+#ifdef _WIN32
+    (void)socket_path;
+    std::cerr << "ERROR: The render server needs UNIX domain sockets\n";
+    return false;
+#else
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path)) {
+      std::cerr << "ERROR: Socket path '" << socket_path << "' is too long\n";
+      return false;
+    }
+    std::memcpy(address.sun_path, socket_path.c_str(), socket_path.size());
+
+    // A socket left by an earlier server is replaced, anything else kept.
+    struct stat existing;
+    if (lstat(socket_path.c_str(), &existing) == 0) {
+      if (!S_ISSOCK(existing.st_mode)) {
+        std::cerr << "ERROR: '" << socket_path << "' exists and is not a "
+          "socket\n";
+        return false;
+      }
+      unlink(socket_path.c_str());
+    }
+
+    const int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0
+        || bind(listener, reinterpret_cast<sockaddr*>(&address),
+                sizeof(address)) != 0
+        || listen(listener, 8) != 0) {
+      std::cerr << "ERROR: Could not listen on '" << socket_path << "'\n";
+      if (listener >= 0) {
+        close(listener);
+      }
+      return false;
+    }
+
+    // A client hanging up early must not take the server with it.
+    std::signal(SIGPIPE, SIG_IGN);
+    std::clog << "Serving on " << socket_path << "\n";
+
+    bool running = true;
+    while (running) {
+      const int client = accept(listener, nullptr, nullptr);
+      if (client < 0) {
+        continue;
+      }
+      timeval timeout;
+      timeout.tv_sec = receive_timeout;
+      timeout.tv_usec = 0;
+      setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+      setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+      running = serve_client(client);
+      close(client);
+    }
+
+    close(listener);
+    unlink(socket_path.c_str());
+    return true;
+#endif
+  }
+
+ private:
+  camera          m_camera;
+  const hittable& m_world;
+  image_format    m_format;
+  int             m_jobs = 0;
+
+  // The last job, kept so that one asking for more samples can continue it.
+  bool            m_has_last = false;
+  camera          m_last_camera;
+  render_state    m_last_state;
+
+#ifndef _WIN32
+  // Returns false when the client asked the server to stop.
+  bool serve_client(int client) {
+    camera cam = m_camera;
+    image_format format = m_format;
+    std::string error;
+    std::string pending;
+    bool done = false;
+    bool closed = false;
+    bool quit = false;
+
+    char buffer[4096];
+    while (!done && !closed) {
+      const ssize_t got = read(client, buffer, sizeof(buffer));
+      if (got > 0) {
+        pending.append(buffer, static_cast<size_t>(got));
+      } else if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        error = "timed out waiting for the job";
+        done = true;
+      } else {
+        // The last line needs no newline when the client closes its side.
+        pending += '\n';
+        closed = true;
+      }
+
+      size_t end;
+      while (!done && (end = pending.find('\n')) != std::string::npos) {
+        const std::string line = pending.substr(0, end);
+        pending.erase(0, end + 1);
+        if (!read_setting(line, cam, format, done, quit, error)) {
+          done = true;
+        }
+      }
+    }
+
+    if (quit) {
+      return false;
+    }
+
+    std::string reply;
+    if (error.empty()) {
+      try {
+        reply = render_job(cam, format, error);
+      } catch (const std::bad_alloc&) {
+        // The last job's state may be half replaced.
+        m_has_last = false;
+        error = "out of memory";
+      }
+    }
+    if (!error.empty()) {
+      reply = "ERROR: " + error + "\n";
+      std::clog << reply;
+    }
+    send_all(client, reply);
+    return true;
+  }
+
+  static void send_all(int client, const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+      const ssize_t n = write(client, data.data() + sent, data.size() - sent);
+      if (n <= 0) {
+        return;
+      }
+      sent += static_cast<size_t>(n);
+    }
+  }
+#endif
+
+  // Applies one line of a job. Sets done at the end of the job and quit
+  // when the server should stop.
+  static bool read_setting(
+    const std::string& line, camera& cam, image_format& format, bool& done,
+    bool& quit, std::string& error) {
+    std::istringstream in(line);
+    std::string key;
+    if (!(in >> key) || key[0] == '#') {
+      return true;
+    }
+
+    if (key == "render") {
+      done = true;
+    } else if (key == "quit") {
+      done = quit = true;
+    } else if (key == "format") {
+      std::string name;
+      std::string extra;
+      if (!(in >> name) || !parse_image_format(name, format)
+          || in >> extra) {
+        error = "bad value for 'format'";
+        return false;
+      }
+    } else {
+      return read_camera_setting_line(key, in, cam, error);
+    }
+    return true;
+  }
+
+  // Whether cam only differs from the last job by asking for at least as
+  // many samples, and the last render can be continued: its passes are
+  // those cam would render first only when the last one was whole.
+  bool continues_last(const camera& cam) const {
+    if (!m_has_last
+        || cam.samples_per_pixel < m_last_camera.samples_per_pixel
+        || m_last_camera.samples_per_pixel
+             % std::max(m_last_camera.samples_per_pass, 1) != 0) {
+      return false;
+    }
+    camera same_samples = cam;
+    same_samples.samples_per_pixel = m_last_camera.samples_per_pixel;
+    return same_samples.settings_hash() == m_last_camera.settings_hash();
+  }
+
+  std::string render_job(camera& cam, image_format format,
+                         std::string& error) {
+    timer job_timer;
+    cam.initialize();
+    if (static_cast<int64_t>(cam.image_width) * cam.image_height
+        > max_pixels) {
+      error = "image of more than " + std::to_string(max_pixels)
+        + " pixels";
+      return std::string();
+    }
+
+    const bool continued = continues_last(cam);
+    if (!continued) {
+      m_last_state = render_state(cam.image_width, cam.image_height,
+                                  cam.settings_hash());
+    }
+    cam.render_passes(m_world, m_last_state);
+    m_last_camera = cam;
+    m_has_last = true;
+
+    std::ostringstream image;
+    m_last_state.resolve().write(image, format);
+
+    std::clog << "Job " << ++m_jobs << ": " << cam.image_width << "x"
+      << cam.image_height << " at " << cam.samples_per_pixel << " spp"
+      << (continued ? " (continued)" : "") << " in " << job_timer.seconds()
+      << " s\n";
+    return image.str();
+  }
+};
+
+#endif  // _RENDER_SERVER_H_
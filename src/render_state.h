@@ -0,0 +1,190 @@
+#ifndef _RENDER_STATE_H_
+#define _RENDER_STATE_H_
+
+#include "rtweekend.h"
+#include "framebuffer.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// What a render has accumulated so far: the sum of every pixel's samples,
+// how many samples that is, and how many passes are complete. The camera
+// renders in passes whose random numbers only depend on the row and the
+// pass, so a render resumed from a saved state finishes with exactly the
+// image an uninterrupted one would have.
+class render_state {
+ public:
+  // An empty state, which takes its size and settings from the first one
+  // loaded into it.
+  render_state() : render_state(0, 0, 0) {}
+
+  render_state(int width, int height, uint64_t settings)
+  : m_width(width)
+  , m_height(height)
+  , m_settings(settings)
+  , m_sums(static_cast<size_t>(width) * height, color(0.0, 0.0, 0.0))
+  , m_counts(static_cast<size_t>(width) * height, 0u) {}
+
+  int width() const { return m_width; }
+  int height() const { return m_height; }
+
+  int passes_done() const { return m_passes_done; }
+  void set_passes_done(int passes) { m_passes_done = passes; }
+
+  // Rows are only ever added to by one thread at a time.
+  void add(int x, int y, const color& sum, uint32_t samples) {
+    const size_t i = index(x, y);
+    m_sums[i] += sum;
+    m_counts[i] += samples;
+  }
+
+  uint32_t samples(int x, int y) const { return m_counts[index(x, y)]; }
+
+  // Adds the samples of a render of other passes with the same settings.
+  void merge(const render_state& other) {
+    for (size_t i = 0; i < m_sums.size(); ++i) {
+      m_sums[i] += other.m_sums[i];
+      m_counts[i] += other.m_counts[i];
+    }
+    m_passes_done = std::max(m_passes_done, other.m_passes_done);
+  }
+
+  bool same_settings(const render_state& other) const {
+    return m_width == other.m_width && m_height == other.m_height
+        && m_settings == other.m_settings;
+  }
+
+  // The mean of each pixel's samples, black where there are none yet.
+  framebuffer resolve() const {
+    framebuffer image(m_width, m_height);
+    for (int y = 0; y < m_height; ++y) {
+      for (int x = 0; x < m_width; ++x) {
+        const size_t i = index(x, y);
+        if (m_counts[i] > 0) {
+          image.at(x, y) = m_sums[i] * (1.0 / m_counts[i]);
+        }
+      }
+    }
+    return image;
+  }
+
+  // Writes a temporary file next to path and renames it over path, so a
+  // crash while saving keeps the previous checkpoint.
+  bool save(const std::string& path, std::ostream& err) const {
+    const std::string temporary = path + ".tmp";
+    std::FILE* out = std::fopen(temporary.c_str(), "wb");
+    const bool written = out && write(out);
+    if (!out || std::fclose(out) != 0 || !written) {
+      err << "ERROR: Could not write checkpoint '" << temporary << "'\n";
+      return false;
+    }
+
+    // Windows does not rename over an existing file.
+    if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+      std::remove(path.c_str());
+      if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+        err << "ERROR: Could not replace checkpoint '" << path << "'\n";
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool load(const std::string& path, std::ostream& err) {
+    std::FILE* in = std::fopen(path.c_str(), "rb");
+    if (!in) {
+      err << "ERROR: Could not open checkpoint '" << path << "'\n";
+      return false;
+    }
+    const bool ok = read(in, path, err);
+    std::fclose(in);
+    return ok;
+  }
+
+  bool write(std::FILE* out) const {
+    const header h = make_header();
+    return std::fwrite(&h, sizeof(h), 1, out) == 1
+        && std::fwrite(m_sums.data(), sizeof(color), m_sums.size(), out)
+           == m_sums.size()
+        && std::fwrite(m_counts.data(), sizeof(uint32_t), m_counts.size(),
+                       out) == m_counts.size();
+  }
+
+  // Reads a state saved by a render with the same image size and settings;
+  // name is only used in messages.
+  bool read(std::FILE* in, const std::string& name, std::ostream& err) {
+    header saved;
+    const header expected = make_header();
+    if (std::fread(&saved, sizeof(saved), 1, in) != 1
+        || std::memcmp(saved.magic, expected.magic, sizeof(saved.magic)) != 0
+        || saved.version != expected.version
+        || saved.byte_order != expected.byte_order
+        || saved.width < 0 || saved.height < 0) {
+      err << "ERROR: '" << name << "' is not a checkpoint of this renderer\n";
+      return false;
+    }
+
+    if (m_width == 0 && m_height == 0) {
+      *this = render_state(saved.width, saved.height, saved.settings);
+    } else if (saved.width != expected.width
+               || saved.height != expected.height
+               || saved.settings != expected.settings) {
+      err << "ERROR: Checkpoint '" << name
+          << "' was saved with different camera settings\n";
+      return false;
+    }
+
+    if (std::fread(m_sums.data(), sizeof(color), m_sums.size(), in)
+          != m_sums.size()
+        || std::fread(m_counts.data(), sizeof(uint32_t), m_counts.size(), in)
+          != m_counts.size()) {
+      err << "ERROR: Checkpoint '" << name << "' is truncated\n";
+      return false;
+    }
+
+    m_passes_done = saved.passes_done;
+    return true;
+  }
+
+ private:
+  struct header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    int32_t  width;
+    int32_t  height;
+    uint64_t settings;
+    int32_t  passes_done;
+    int32_t  unused;
+  };
+
+  int                   m_width;
+  int                   m_height;
+  uint64_t              m_settings;
+  int                   m_passes_done = 0;
+  std::vector<color>    m_sums;
+  std::vector<uint32_t> m_counts;
+
+  size_t index(int x, int y) const {
+    return static_cast<size_t>(y) * m_width + x;
+  }
+
+  header make_header() const {
+    header h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, "RTWCKPT", 8);
+    h.version = 1;
+    h.byte_order = 0x01020304u;
+    h.width = m_width;
+    h.height = m_height;
+    h.settings = m_settings;
+    h.passes_done = m_passes_done;
+    return h;
+  }
+};
+
+#endif  // _RENDER_STATE_H_
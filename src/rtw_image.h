@@ -5,8 +5,13 @@
 #define STBI_FAILURE_USERMSG
 #include "../ext/stb_image.h"
 
+#include "rtweekend.h"
+
+#include <algorithm>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <vector>
 
 class rtw_image {
  public:
@@ -27,45 +32,161 @@ class rtw_image {
       << image_filename << "'\n";
   }
 
-  ~rtw_image() {
-    delete[] bdata;
-    STBI_FREE(fdata);
-  }
+  // 8 bit files keep their sRGB encoded bytes, which are decoded to linear
+  // through a table on every read. HDR files are already linear and are
+  // stored as floats.
+  enum class pixel_format { srgb8, float32 };
 
   bool load(const std::string& filename) {
-    int n = bytes_per_pixel;
-    fdata = stbi_loadf(
-      filename.c_str(), &image_width, &image_heigth, &n, bytes_per_pixel);
+    const char* name = filename.c_str();
 
-    if (fdata == nullptr) {
-      return false;
+    if (stbi_is_hdr(name)) {
+      float* fdata = stbi_loadf(
+        name, &image_width, &image_heigth, nullptr, channels);
+      if (fdata == nullptr) {
+        return false;
+      }
+      format = pixel_format::float32;
+      store_base(reinterpret_cast<const unsigned char*>(fdata));
+      STBI_FREE(fdata);
+    } else {
+      unsigned char* bdata = stbi_load(
+        name, &image_width, &image_heigth, nullptr, channels);
+      if (bdata == nullptr) {
+        return false;
+      }
+      format = pixel_format::srgb8;
+      store_base(bdata);
+      STBI_FREE(bdata);
     }
 
-    bytes_per_scanline = image_width * bytes_per_pixel;
-    convert_to_bytes();
+    build_mips();
     return true;
   }
 
-  int width() const { return (fdata == nullptr) ? 0 : image_width; }
-  int height() const { return (fdata == nullptr) ? 0 : image_heigth; }
+  int width() const { return levels.empty() ? 0 : image_width; }
+  int height() const { return levels.empty() ? 0 : image_heigth; }
+
+  // Levels of the mip pyramid, level 0 being the image itself and every
+  // further level half the size of the one before, down to 1x1.
+  int level_count() const { return static_cast<int>(levels.size()); }
+
+  int width(int level) const { return levels[level].width; }
+  int height(int level) const { return levels[level].height; }
+
+  // Linear color of a texel, clamped to the edges.
+  color pixel(int x, int y, int level) const {
+    if (levels.empty()) return color(1.0, 0.0, 1.0);
+
+    const tiled_level& l = levels[level];
+    x = clamp(x, 0, l.width);
+    y = clamp(y, 0, l.height);
+
+    return decode(format, l.data.data() + l.offset(x, y));
+  }
+
+  color pixel(int x, int y) const { return pixel(x, y, 0); }
+
+  static const int channels = 3;
+  // Pixels are stored in square tiles of tile_size x tile_size, one tile
+  // after the other, so the neighbours a filtered lookup reads are close in
+  // memory in both directions.
+  static const int tile_size = 8;
+
+  pixel_format pixel_type() const { return format; }
+
+  int pixel_bytes() const { return pixel_bytes(format); }
+
+  static int pixel_bytes(pixel_format f) {
+    return f == pixel_format::srgb8
+      ? channels : channels * static_cast<int>(sizeof(float));
+  }
+
+  int tile_bytes() const { return tile_size * tile_size * pixel_bytes(); }
 
-  const unsigned char* pixel_data(int x, int y) const {
-    static unsigned char magenta[] = { 255, 0, 255 };
-    if (bdata == nullptr) return magenta;
+  int tiles_x(int level) const { return levels[level].tiles_x; }
 
-    x = clamp(x, 0, image_width);
-    y = clamp(y, 0, image_heigth);
+  int tile_count(int level) const {
+    return static_cast<int>(levels[level].data.size() / tile_bytes());
+  }
+
+  const unsigned char* tile_data(int level, int tile) const {
+    return levels[level].data.data()
+      + static_cast<size_t>(tile) * tile_bytes();
+  }
+
+  // Linear color of one stored pixel.
+  static color decode(pixel_format f, const unsigned char* data) {
+    if (f == pixel_format::srgb8) {
+      const float* lut = srgb().to_linear;
+      return color(lut[data[0]], lut[data[1]], lut[data[2]]);
+    }
 
-    return bdata + y * bytes_per_scanline + x * bytes_per_pixel;
+    float value[channels];
+    std::memcpy(value, data, sizeof(value));
+    return color(value[0], value[1], value[2]);
   }
 
  private:
-  const int bytes_per_pixel = 3;
-  float *fdata = nullptr;
-  unsigned char *bdata = nullptr;
+  struct tiled_level {
+    int width;
+    int height;
+    int tiles_x;
+    int pixel_bytes;
+    std::vector<unsigned char> data;
+
+    tiled_level(int w, int h, int bytes)
+    : width(w), height(h), tiles_x((w + tile_size - 1) / tile_size)
+    , pixel_bytes(bytes) {
+      const int tiles_y = (h + tile_size - 1) / tile_size;
+      data.resize(static_cast<size_t>(tiles_x) * tiles_y
+                  * tile_size * tile_size * pixel_bytes);
+    }
+
+    size_t offset(int x, int y) const {
+      const size_t ux = static_cast<size_t>(x);
+      const size_t uy = static_cast<size_t>(y);
+      const size_t tile = (uy / tile_size) * tiles_x + ux / tile_size;
+      const size_t in_tile = (uy % tile_size) * tile_size + ux % tile_size;
+      return (tile * tile_size * tile_size + in_tile) * pixel_bytes;
+    }
+
+    unsigned char* pixel(int x, int y) { return data.data() + offset(x, y); }
+  };
+
+  // The sRGB transfer function for every byte value. Encoding picks the
+  // byte whose linear value is nearest, by searching the midpoints between
+  // neighbouring entries.
+  struct srgb_tables {
+    float to_linear[256];
+    float midpoints[255];
+
+    srgb_tables() {
+      for (int i = 0; i < 256; ++i) {
+        const double c = i / 255.0;
+        to_linear[i] = static_cast<float>(
+          c <= 0.04045 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4));
+      }
+      for (int i = 0; i < 255; ++i) {
+        midpoints[i] = 0.5f * (to_linear[i] + to_linear[i + 1]);
+      }
+    }
+
+    unsigned char encode(double linear) const {
+      return static_cast<unsigned char>(
+        std::upper_bound(midpoints, midpoints + 255, linear) - midpoints);
+    }
+  };
+
+  static const srgb_tables& srgb() {
+    static const srgb_tables tables;
+    return tables;
+  }
+
   int image_width = 0;
   int image_heigth = 0;
-  int bytes_per_scanline = 0;
+  pixel_format format = pixel_format::srgb8;
+  std::vector<tiled_level> levels;
 
   static int clamp(int x, int low, int high) {
     if (x < low) return low;
@@ -73,26 +194,66 @@ class rtw_image {
     return high - 1;
   }
 
-  static unsigned char float_to_byte(float value) {
-    if (value <= 0.0) {
-      return 0;
+  // Stores a linear color in the image's format.
+  void encode(const color& c, unsigned char* out) const {
+    if (format == pixel_format::srgb8) {
+      for (int i = 0; i < channels; ++i) {
+        out[i] = srgb().encode(c[i]);
+      }
+      return;
     }
-    if (1.0 <= value) {
-      return 255;
+
+    const float value[channels] = {
+      static_cast<float>(c[0]), static_cast<float>(c[1]),
+      static_cast<float>(c[2])
+    };
+    std::memcpy(out, value, sizeof(value));
+  }
+
+  // Copies the decoded rows into the tiles of the first level, as is.
+  void store_base(const unsigned char* data) {
+    levels.clear();
+    levels.emplace_back(image_width, image_heigth, pixel_bytes());
+    tiled_level& base = levels.back();
+
+    const size_t bytes = pixel_bytes();
+    for (int y = 0; y < image_heigth; ++y) {
+      for (int x = 0; x < image_width; ++x, data += bytes) {
+        std::memcpy(base.pixel(x, y), data, bytes);
+      }
     }
-    return static_cast<unsigned char>(256.0 * value);
   }
 
-  void convert_to_bytes() {
-    const int total_bytes = image_width * image_heigth * bytes_per_pixel;
-    bdata = new unsigned char[total_bytes];
+  // Box filters every level from the one above it, averaging in linear
+  // space. Odd sizes round down and the last row or column is clamped.
+  void build_mips() {
+    int level = 0;
+    while (width(level) > 1 || height(level) > 1) {
+      const int src_width = width(level);
+      const int src_height = height(level);
+
+      tiled_level mip(
+        src_width > 1 ? src_width / 2 : 1,
+        src_height > 1 ? src_height / 2 : 1,
+        pixel_bytes());
 
-    unsigned char *bptr = bdata;
-    float *fptr = fdata;
-    for (int i = 0; i < total_bytes; ++i, ++fptr, ++bptr) {
-      *bptr = float_to_byte(*fptr);
+      for (int y = 0; y < mip.height; ++y) {
+        for (int x = 0; x < mip.width; ++x) {
+          const color sum = pixel(2 * x, 2 * y, level)
+                          + pixel(2 * x + 1, 2 * y, level)
+                          + pixel(2 * x, 2 * y + 1, level)
+                          + pixel(2 * x + 1, 2 * y + 1, level);
+          encode(0.25 * sum, mip.pixel(x, y));
+        }
+      }
+
+      levels.push_back(std::move(mip));
+      ++level;
     }
   }
 };
 
+const int rtw_image::channels;
+const int rtw_image::tile_size;
+
 #endif  // _RTW_IMAGE_H_
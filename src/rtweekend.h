@@ -2,6 +2,7 @@
 #define _RTWEEKEND_H_
 
 #include <cmath>
+#include <cstdint>
 #include <cstdlib>
 #include <iostream>
 #include <limits>
@@ -14,8 +15,34 @@ inline double degrees_to_radians(double degrees) {
   return degrees * (pi / 180.0);
 }
 
+// State of the calling thread's random generator, so threads never share
+// one. Renderers reseed it per scanline, which keeps images independent of
+// how rows are spread over threads.
+inline uint64_t& random_state() {
+  thread_local uint64_t state = 0x853c49e6748fea9bull;
+  return state;
+}
+
+// The splitmix64 output function, a cheap bijective scramble of 64 bits.
+inline uint64_t mix_bits(uint64_t z) {
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+  return z ^ (z >> 31);
+}
+
+// Nearby seeds, such as consecutive row numbers, are scrambled apart so
+// their sequences do not overlap.
+inline void seed_random(uint64_t seed) {
+  random_state() = mix_bits(seed);
+}
+
+// splitmix64.
+inline uint64_t random_bits() {
+  return mix_bits(random_state() += 0x9e3779b97f4a7c15ull);
+}
+
 inline double random_double() {
-  return static_cast<double>(rand()) / (RAND_MAX + 1.0);
+  return (random_bits() >> 11) * (1.0 / 9007199254740992.0);
 }
 
 inline double random_double(double min, double max) {
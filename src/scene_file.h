@@ -0,0 +1,689 @@
+#ifndef _SCENE_FILE_H_
+#define _SCENE_FILE_H_
+
+#include "rtweekend.h"
+#include "aligned_box.h"
+#include "arena.h"
+#include "camera.h"
+#include "camera_settings.h"
+#include "constant_medium.h"
+#include "flat_bvh.h"
+#include "grid_medium.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "material_registry.h"
+#include "quad.h"
+#include "sphere.h"
+#include "texture.h"
+#include "timer.h"
+#include "triangle.h"
+
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// A scene read from a text file, one statement per line and '#' starting a
+// comment:
+//
+//   camera KEY VALUE...       any of the settings read by
+//                             read_camera_setting in camera_settings.h
+//   texture NAME solid R G B
+//   texture NAME checker SCALE EVEN ODD
+//   texture NAME image FILE
+//   texture NAME noise SCALE [SEED] [bake RES X1 Y1 Z1 X2 Y2 Z2]
+//   material NAME lambertian|light|isotropic ALBEDO
+//   material NAME metal R G B FUZZ
+//   material NAME dielectric INDEX
+//   sphere X Y Z RADIUS MATERIAL
+//   moving_sphere X1 Y1 Z1 X2 Y2 Z2 RADIUS MATERIAL
+//   quad QX QY QZ UX UY UZ VX VY VZ MATERIAL
+//   triangle QX QY QZ UX UY UZ VX VY VZ MATERIAL
+//   box X1 Y1 Z1 X2 Y2 Z2 MATERIAL
+//   medium DENSITY ALBEDO SHAPE...   constant density inside a sphere,
+//                                    moving_sphere, quad, triangle or box
+//                                    given without a material
+//   grid_medium X1 Y1 Z1 X2 Y2 Z2 DENSITY ALBEDO perlin N SCALE [SEED]
+//   grid_medium X1 Y1 Z1 X2 Y2 Z2 DENSITY ALBEDO raw FILE NX NY NZ
+//   translate X Y Z | rotate_y DEGREES | identity | push | pop
+//   mesh MATERIAL, then v X Y Z and f I J K... lines, then end
+//
+// ALBEDO, EVEN and ODD are either R G B or the name of a texture. Transforms
+// apply to everything after them, a rotation about the object's origin
+// before any translation; push and pop save and restore the current one.
+// Mesh vertices are transformed as they are read, face indices count from
+// one (negative ones from the last vertex) and polygons become fans. A
+// baked noise texture looks its turbulence up in a grid of RES samples
+// along the longest side of the box, and evaluates it outside the box.
+//
+// The file is read in blocks and every statement builds its objects right
+// away, so no syntax tree is kept and memory does not grow with the file
+// beyond the scene itself. Everything is allocated in the scene's arena.
+class scene_file {
+ public:
+  scene_file() : m_materials(m_arena) {}
+
+  scene_file(const scene_file&) = delete;
+  scene_file& operator=(const scene_file&) = delete;
+
+  // Reads and builds the scene, reporting the first error with its line.
+  bool load(const std::string& path, std::ostream& err) {
+    timer parse_timer;
+    if (!parse(path, err)) {
+      return false;
+    }
+    m_parse_seconds = parse_timer.seconds();
+
+    timer build_timer;
+    if (!m_world.objects.empty()) {
+      m_world = hittable_list(m_arena.make<flat_bvh>(m_world));
+    }
+    m_build_seconds = build_timer.seconds();
+    return true;
+  }
+
+  camera& cam() { return m_camera; }
+  const hittable& world() const { return m_world; }
+
+  size_t line_count() const { return m_line; }
+  size_t object_count() const { return m_object_count; }
+  double parse_seconds() const { return m_parse_seconds; }
+  double build_seconds() const { return m_build_seconds; }
+
+ private:
+  static const size_t block_size = 64 * 1024;
+  // Voxels along each side of a density grid, so a grid stays within 4 GB.
+  static const int    max_grid_size = 1024;
+
+  struct transform {
+    double angle = 0.0;
+    vec3   offset = vec3(0.0, 0.0, 0.0);
+  };
+
+  scene_arena                                     m_arena;
+  material_registry                               m_materials;
+  std::map<std::string, std::shared_ptr<texture>> m_textures;
+  std::map<std::string, std::shared_ptr<material>> m_named_materials;
+  hittable_list                                   m_world;
+  camera                                          m_camera;
+  transform                                       m_transform;
+  std::vector<transform>                          m_saved;
+
+  // State of an open mesh block.
+  bool                      m_in_mesh = false;
+  std::shared_ptr<material> m_mesh_material;
+  std::vector<point3>       m_vertices;
+
+  std::vector<char*> m_tokens;
+  size_t             m_next = 0;
+  std::string        m_error;
+  size_t             m_line = 0;
+  size_t             m_object_count = 0;
+  double             m_parse_seconds = 0.0;
+  double             m_build_seconds = 0.0;
+
+  bool parse(const std::string& path, std::ostream& err) {
+    std::FILE* file = std::fopen(path.c_str(), "rb");
+    if (!file) {
+      err << "ERROR: Could not open scene file '" << path << "'\n";
+      return false;
+    }
+
+    // Lines are cut out of the buffer in place; an unfinished one is moved
+    // to the front before the next block is read behind it.
+    std::vector<char> buffer(block_size);
+    size_t filled = 0;
+    bool ok = true;
+
+    while (ok) {
+      if (filled + 1 >= buffer.size()) {
+        buffer.resize(buffer.size() * 2);
+      }
+      const size_t got = std::fread(
+        buffer.data() + filled, 1, buffer.size() - 1 - filled, file);
+      filled += got;
+      const bool at_end = got == 0;
+      if (at_end && filled > 0) {
+        buffer[filled++] = '\n';
+      }
+
+      char* begin = buffer.data();
+      char* const end = begin + filled;
+      while (char* newline = static_cast<char*>(
+               std::memchr(begin, '\n', end - begin))) {
+        *newline = '\0';
+        ++m_line;
+        if (!statement(begin)) {
+          ok = false;
+          break;
+        }
+        begin = newline + 1;
+      }
+
+      filled = end - begin;
+      std::memmove(buffer.data(), begin, filled);
+      if (at_end) {
+        break;
+      }
+    }
+
+    if (ok && std::ferror(file)) {
+      m_error = "read error";
+      ok = false;
+    } else if (ok && m_in_mesh) {
+      m_error = "mesh is missing its 'end'";
+      ok = false;
+    } else if (ok && !m_saved.empty()) {
+      m_error = "'push' without 'pop'";
+      ok = false;
+    }
+    std::fclose(file);
+
+    if (!ok) {
+      err << "ERROR: " << path << ":" << m_line << ": " << m_error << "\n";
+    }
+    return ok;
+  }
+
+  void tokenize(char* line) {
+    m_tokens.clear();
+    m_next = 0;
+    for (char* c = line; *c != '\0'; ) {
+      if (*c == '#') {
+        *c = '\0';
+        break;
+      }
+      if (*c == ' ' || *c == '\t' || *c == '\r') {
+        *c++ = '\0';
+        continue;
+      }
+      m_tokens.push_back(c);
+      while (*c != '\0' && *c != ' ' && *c != '\t' && *c != '\r'
+             && *c != '#') {
+        ++c;
+      }
+    }
+  }
+
+  bool statement(char* line) {
+    tokenize(line);
+    if (m_tokens.empty()) {
+      return true;
+    }
+
+    const std::string keyword = next_token();
+    bool ok;
+    if (m_in_mesh) {
+      ok = mesh_statement(keyword);
+    } else if (keyword == "camera") {
+      ok = camera_statement();
+    } else if (keyword == "texture") {
+      ok = texture_statement();
+    } else if (keyword == "material") {
+      ok = material_statement();
+    } else if (keyword == "medium") {
+      ok = medium_statement();
+    } else if (keyword == "grid_medium") {
+      ok = grid_medium_statement();
+    } else if (keyword == "mesh") {
+      ok = read_material(m_mesh_material);
+      m_in_mesh = ok;
+      m_vertices.clear();
+    } else if (keyword == "translate") {
+      vec3 offset;
+      ok = read_vec3(offset);
+      m_transform.offset += offset;
+    } else if (keyword == "rotate_y") {
+      double degrees;
+      ok = read_number(degrees);
+      m_transform.angle += degrees;
+      m_transform.offset = rotated(m_transform.offset, degrees);
+    } else if (keyword == "identity") {
+      m_transform = transform();
+      ok = true;
+    } else if (keyword == "push") {
+      m_saved.push_back(m_transform);
+      ok = true;
+    } else if (keyword == "pop") {
+      ok = !m_saved.empty();
+      if (ok) {
+        m_transform = m_saved.back();
+        m_saved.pop_back();
+      } else {
+        m_error = "'pop' without 'push'";
+      }
+    } else {
+      std::shared_ptr<hittable> object;
+      ok = read_shape(keyword, nullptr, object);
+      if (ok) add(object);
+    }
+
+    if (ok && m_next < m_tokens.size()) {
+      m_error = "unexpected '" + std::string(m_tokens[m_next]) + "'";
+      ok = false;
+    }
+    return ok;
+  }
+
+  bool camera_statement() {
+    if (m_next == m_tokens.size()) {
+      m_error = "camera needs at least one setting";
+      return false;
+    }
+
+    std::string settings;
+    while (m_next < m_tokens.size()) {
+      settings += next_token();
+      settings += ' ';
+    }
+
+    std::istringstream in(settings);
+    std::string key;
+    while (in >> key) {
+      if (!read_camera_setting(key, in, m_camera, m_error)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool texture_statement() {
+    std::string name;
+    if (!read_new_name(name, m_textures)) return false;
+    const std::string kind = next_token();
+
+    std::shared_ptr<texture> tex;
+    if (kind == "solid") {
+      color albedo;
+      if (!read_vec3(albedo)) return false;
+      tex = m_materials.solid(albedo);
+    } else if (kind == "checker") {
+      double scale;
+      std::shared_ptr<texture> even, odd;
+      if (!read_number(scale) || !read_albedo(even) || !read_albedo(odd)) {
+        return false;
+      }
+      tex = m_arena.make<checker_texture>(scale, even, odd);
+    } else if (kind == "image") {
+      if (m_next == m_tokens.size()) {
+        m_error = "image texture needs a file name";
+        return false;
+      }
+      tex = m_arena.make<image_texture>(next_token());
+    } else if (kind == "noise") {
+      double scale;
+      uint32_t seed = perlin::default_seed;
+      if (!read_number(scale)) return false;
+      if (m_next < m_tokens.size()
+          && std::strcmp(m_tokens[m_next], "bake") != 0
+          && !read_seed(seed)) {
+        return false;
+      }
+      if (m_next == m_tokens.size()) {
+        tex = m_arena.make<noise_texture>(scale, seed);
+      } else {
+        const std::string word = next_token();
+        int resolution;
+        point3 a, b;
+        if (word != "bake") {
+          m_error = "expected 'bake', got '" + word + "'";
+          return false;
+        }
+        if (!read_integer(resolution, 2, max_grid_size) || !read_vec3(a)
+            || !read_vec3(b)) {
+          return false;
+        }
+        if (a.x() == b.x() || a.y() == b.y() || a.z() == b.z()) {
+          m_error = "bake box needs a size along every axis";
+          return false;
+        }
+        tex = m_arena.make<noise_texture>(
+          scale, aabb(a, b), resolution, seed);
+      }
+    } else {
+      m_error = "unknown texture type '" + kind + "'";
+      return false;
+    }
+
+    m_textures.emplace(name, tex);
+    return true;
+  }
+
+  bool material_statement() {
+    std::string name;
+    if (!read_new_name(name, m_named_materials)) return false;
+    const std::string kind = next_token();
+
+    std::shared_ptr<material> mat;
+    std::shared_ptr<texture> tex;
+    if (kind == "lambertian" || kind == "light" || kind == "isotropic") {
+      if (!read_albedo(tex)) return false;
+      mat = kind == "lambertian" ? m_materials.lambertian(tex)
+          : kind == "light"      ? m_materials.diffuse_light(tex)
+          :                        m_materials.isotropic(tex);
+    } else if (kind == "metal") {
+      color albedo;
+      double fuzz;
+      if (!read_vec3(albedo) || !read_number(fuzz)) return false;
+      mat = m_materials.metal(albedo, fuzz);
+    } else if (kind == "dielectric") {
+      double index;
+      if (!read_number(index)) return false;
+      mat = m_materials.dielectric(index);
+    } else {
+      m_error = "unknown material type '" + kind + "'";
+      return false;
+    }
+
+    m_named_materials.emplace(name, mat);
+    return true;
+  }
+
+  // The boundary gets the phase function as its material; a medium only
+  // asks it for the span inside.
+  bool medium_statement() {
+    double density;
+    std::shared_ptr<texture> albedo;
+    if (!read_number(density) || !read_albedo(albedo)) return false;
+
+    const std::shared_ptr<material> phase = m_materials.isotropic(albedo);
+    std::shared_ptr<hittable> boundary;
+    if (!read_shape(next_token(), phase, boundary)) return false;
+
+    add(m_arena.make<constant_medium>(boundary, density, phase));
+    return true;
+  }
+
+  bool grid_medium_statement() {
+    point3 a, b;
+    double density;
+    std::shared_ptr<texture> albedo;
+    if (!read_vec3(a) || !read_vec3(b) || !read_number(density)
+        || !read_albedo(albedo)) {
+      return false;
+    }
+
+    const std::string source = next_token();
+    std::shared_ptr<density_grid> grid;
+    if (source == "perlin") {
+      int n;
+      double scale;
+      uint32_t seed = perlin::default_seed;
+      if (!read_integer(n, 1, max_grid_size) || !read_number(scale)) {
+        return false;
+      }
+      if (m_next < m_tokens.size() && !read_seed(seed)) return false;
+      grid = m_arena.make<density_grid>(density_grid::from_perlin(
+        n, n, n, scale, seed));
+    } else if (source == "raw") {
+      if (m_next == m_tokens.size()) {
+        m_error = "raw grid needs a file name";
+        return false;
+      }
+      const std::string file = next_token();
+      int nx, ny, nz;
+      if (!read_integer(nx, 1, max_grid_size)
+          || !read_integer(ny, 1, max_grid_size)
+          || !read_integer(nz, 1, max_grid_size)) {
+        return false;
+      }
+      density_grid loaded;
+      if (!density_grid::load_raw(file, nx, ny, nz, loaded, m_error)) {
+        return false;
+      }
+      grid = m_arena.make<density_grid>(std::move(loaded));
+    } else {
+      m_error = "grid_medium needs 'perlin' or 'raw', got '" + source + "'";
+      return false;
+    }
+
+    add(m_arena.make<grid_medium>(
+      aabb(a, b), grid, density, m_materials.isotropic(albedo)));
+    return true;
+  }
+
+  bool mesh_statement(const std::string& keyword) {
+    if (keyword == "v") {
+      point3 p;
+      if (!read_vec3(p)) return false;
+      m_vertices.push_back(
+        rotated(p, m_transform.angle) + m_transform.offset);
+      return true;
+    }
+
+    if (keyword == "f") {
+      size_t first, previous, current;
+      if (!read_vertex(first) || !read_vertex(previous)) return false;
+      do {
+        if (!read_vertex(current)) return false;
+        const point3& q = m_vertices[first];
+        m_world.add(m_arena.make<triangle>(
+          q, m_vertices[previous] - q, m_vertices[current] - q,
+          m_mesh_material));
+        ++m_object_count;
+        previous = current;
+      } while (m_next < m_tokens.size());
+      return true;
+    }
+
+    if (keyword == "end") {
+      m_in_mesh = false;
+      m_vertices.clear();
+      return true;
+    }
+
+    m_error = "expected 'v', 'f' or 'end' in mesh, got '" + keyword + "'";
+    return false;
+  }
+
+  // Reads the arguments of a shape, followed by its material unless mat is
+  // given.
+  bool read_shape(
+    const std::string& kind,
+    std::shared_ptr<material> mat,
+    std::shared_ptr<hittable>& object) {
+    point3 a, b;
+    vec3 u, v;
+    double radius;
+
+    if (kind == "sphere") {
+      if (!read_vec3(a) || !read_number(radius)) return false;
+      if (!mat && !read_material(mat)) return false;
+      object = m_arena.make<sphere>(a, radius, mat);
+    } else if (kind == "moving_sphere") {
+      if (!read_vec3(a) || !read_vec3(b) || !read_number(radius)) {
+        return false;
+      }
+      if (!mat && !read_material(mat)) return false;
+      object = m_arena.make<sphere>(a, b, radius, mat);
+    } else if (kind == "quad" || kind == "triangle") {
+      if (!read_vec3(a) || !read_vec3(u) || !read_vec3(v)) return false;
+      if (!mat && !read_material(mat)) return false;
+      if (kind == "quad") {
+        object = m_arena.make<quad>(a, u, v, mat);
+      } else {
+        object = m_arena.make<triangle>(a, u, v, mat);
+      }
+    } else if (kind == "box") {
+      if (!read_vec3(a) || !read_vec3(b)) return false;
+      if (!mat && !read_material(mat)) return false;
+      object = box(a, b, mat, m_arena);
+    } else {
+      m_error = kind.empty() ? "missing shape"
+                             : "unknown statement '" + kind + "'";
+      return false;
+    }
+    return true;
+  }
+
+  void add(std::shared_ptr<hittable> object) {
+    m_world.add(transformed(object));
+    ++m_object_count;
+  }
+
+  // Wraps object in the current transform, the same way the built in
+  // scenes do, so the BVH turns it into an instance.
+  std::shared_ptr<hittable> transformed(std::shared_ptr<hittable> object) {
+    if (m_transform.angle != 0.0) {
+      object = m_arena.make<rotate_y>(object, m_transform.angle);
+    }
+    if (m_transform.offset.length_squared() > 0.0) {
+      object = m_arena.make<translate>(object, m_transform.offset);
+    }
+    return object;
+  }
+
+  // Turns p about the y axis as rotate_y turns its object.
+  static vec3 rotated(const vec3& p, double degrees) {
+    const double radians = degrees_to_radians(degrees);
+    const double s = sin(radians);
+    const double c = cos(radians);
+    return vec3(c * p.x() + s * p.z(), p.y(), -s * p.x() + c * p.z());
+  }
+
+  const char* next_token() {
+    return m_next < m_tokens.size() ? m_tokens[m_next++] : "";
+  }
+
+  bool read_number(double& value) {
+    if (m_next == m_tokens.size()) {
+      m_error = "missing number";
+      return false;
+    }
+    const char* text = m_tokens[m_next++];
+    char* end = nullptr;
+    errno = 0;
+    value = std::strtod(text, &end);
+    if (end == text || *end != '\0' || errno == ERANGE
+        || !std::isfinite(value)) {
+      m_error = "expected a number, got '" + std::string(text) + "'";
+      return false;
+    }
+    return true;
+  }
+
+  // A whole number in [min, max].
+  bool read_integer(int& value, int min, int max) {
+    const size_t token = m_next;
+    double number;
+    if (!read_number(number)) return false;
+    if (number != std::floor(number) || number < min || number > max) {
+      m_error = "expected a whole number "
+        + (max == INT_MAX
+           ? "of at least " + std::to_string(min)
+           : "from " + std::to_string(min) + " to " + std::to_string(max))
+        + ", got '" + std::string(m_tokens[token]) + "'";
+      return false;
+    }
+    value = static_cast<int>(number);
+    return true;
+  }
+
+  bool read_seed(uint32_t& seed) {
+    const size_t token = m_next;
+    double number;
+    if (!read_number(number)) return false;
+    if (number != std::floor(number) || number < 0.0
+        || number > 4294967295.0) {
+      m_error = "expected a seed from 0 to 4294967295, got '"
+        + std::string(m_tokens[token]) + "'";
+      return false;
+    }
+    seed = static_cast<uint32_t>(number);
+    return true;
+  }
+
+  bool read_vec3(vec3& value) {
+    return read_number(value[0]) && read_number(value[1])
+        && read_number(value[2]);
+  }
+
+  // Three numbers, or the name of a texture.
+  bool read_albedo(std::shared_ptr<texture>& tex) {
+    if (m_next == m_tokens.size()) {
+      m_error = "missing color or texture";
+      return false;
+    }
+
+    const char first = m_tokens[m_next][0];
+    if ((first >= '0' && first <= '9') || first == '-' || first == '+'
+        || first == '.') {
+      color albedo;
+      if (!read_vec3(albedo)) return false;
+      tex = m_materials.solid(albedo);
+      return true;
+    }
+
+    const std::string name = next_token();
+    auto found = m_textures.find(name);
+    if (found == m_textures.end()) {
+      m_error = "unknown texture '" + name + "'";
+      return false;
+    }
+    tex = found->second;
+    return true;
+  }
+
+  bool read_material(std::shared_ptr<material>& mat) {
+    if (m_next == m_tokens.size()) {
+      m_error = "missing material";
+      return false;
+    }
+    const std::string name = next_token();
+    auto found = m_named_materials.find(name);
+    if (found == m_named_materials.end()) {
+      m_error = "unknown material '" + name + "'";
+      return false;
+    }
+    mat = found->second;
+    return true;
+  }
+
+  template <typename T>
+  bool read_new_name(
+    std::string& name, const std::map<std::string, T>& defined) {
+    name = next_token();
+    if (name.empty()) {
+      m_error = "missing name";
+      return false;
+    }
+    if (defined.count(name)) {
+      m_error = "'" + name + "' is already defined";
+      return false;
+    }
+    return true;
+  }
+
+  // A face index as written in OBJ files, where anything after a '/' is a
+  // texture or normal index and ignored.
+  bool read_vertex(size_t& index) {
+    if (m_next == m_tokens.size()) {
+      m_error = "face needs at least three vertices";
+      return false;
+    }
+    const char* text = m_tokens[m_next++];
+    char* end = nullptr;
+    const long parsed = std::strtol(text, &end, 10);
+    const long count = static_cast<long>(m_vertices.size());
+    const long resolved = parsed < 0 ? count + parsed : parsed - 1;
+    if (end == text || (*end != '\0' && *end != '/') || parsed == 0
+        || resolved < 0 || resolved >= count) {
+      m_error = "bad vertex index '" + std::string(text) + "'";
+      return false;
+    }
+    index = static_cast<size_t>(resolved);
+    return true;
+  }
+};
+
+const size_t scene_file::block_size;
+const int scene_file::max_grid_size;
+
+#endif  // _SCENE_FILE_H_
@@ -1,15 +1,25 @@
 #ifndef _TEXTURE_H_
 #define _TEXTURE_H_
 
+#include "noise_volume.h"
 #include "perlin.h"
-#include "rtw_image.h"
 #include "rtweekend.h"
+#include "texture_cache.h"
+
+#include <algorithm>
 
 class texture {
  public:
   virtual ~texture() = default;
 
   virtual color value(double u, double v, const point3& p) const = 0;
+
+  // Value averaged over a footprint of the given width in uv units.
+  // Textures without a prefiltered form return the point sample.
+  virtual color filtered_value(
+    double u, double v, const point3& p, double footprint) const {
+    return value(u, v, p);
+  }
 };
 
 class solid_color : public texture {
@@ -23,6 +33,8 @@ class solid_color : public texture {
     return m_albedo;
   }
 
+  const color& albedo() const { return m_albedo; }
+
  private:
   color m_albedo;
 };
@@ -50,6 +62,10 @@ class checker_texture : public texture {
     return isEven ? m_even->value(u, v, p) : m_odd->value(u, v, p);
   }
 
+  double scale() const { return 1.0 / m_inv_scale; }
+  const std::shared_ptr<texture>& even() const { return m_even; }
+  const std::shared_ptr<texture>& odd() const { return m_odd; }
+
  private:
   double m_inv_scale;
   std::shared_ptr<texture> m_even;
@@ -58,43 +74,105 @@ class checker_texture : public texture {
 
 class image_texture : public texture {
  public:
-  image_texture(const char* filename) : m_image(filename) {}
+  // The image is shared through the texture cache and only read from disk
+  // on the first lookup.
+  image_texture(const char* filename)
+  : m_image(texture_cache::global().get(filename)) {}
 
   color value(double u, double v, const point3& p) const override {
-    if (m_image.height() <= 0) {
+    return filtered_value(u, v, p, 0.0);
+  }
+
+  // Trilinear lookup: bilinear in the two mip levels whose texel size
+  // brackets the footprint, blended by where it falls between them.
+  color filtered_value(
+    double u, double v, const point3& p, double footprint) const override {
+    texture_cache::reader image(*m_image);
+    if (!image.valid()) {
       return color(0.0, 1.0, 1.0);
     }
 
     u = interval(0.0, 1.0).clamp(u);
     v = 1.0 - interval(0.0, 1.0).clamp(v);
 
-    const int i = static_cast<int>(u * m_image.width());
-    const int j = static_cast<int>(v * m_image.height());
-    const unsigned char* pixel = m_image.pixel_data(i, j);
-
-    const double color_scale = 1.0 / 255.0;
-    return color(
-      color_scale * pixel[0], color_scale * pixel[1], color_scale * pixel[2]);
+    const double texels =
+      footprint * std::max(image.width(0), image.height(0));
+    const double level = texels > 1.0
+      ? std::min(std::log2(texels), image.level_count() - 1.0)
+      : 0.0;
+
+    const int level0 = static_cast<int>(level);
+    const double blend = level - level0;
+    const color c0 = bilinear(image, u, v, level0);
+    if (blend <= 0.0) {
+      return c0;
+    }
+    return (1.0 - blend) * c0 + blend * bilinear(image, u, v, level0 + 1);
   }
 
+  const std::string& filename() const { return m_image->filename(); }
+
  private:
-  rtw_image m_image;
+  std::shared_ptr<cached_image> m_image;
+
+  static color bilinear(
+    texture_cache::reader& image, double u, double v, int level) {
+    const double x = u * image.width(level) - 0.5;
+    const double y = v * image.height(level) - 0.5;
+    const int x0 = static_cast<int>(std::floor(x));
+    const int y0 = static_cast<int>(std::floor(y));
+    const double fx = x - x0;
+    const double fy = y - y0;
+
+    color accum(0.0, 0.0, 0.0);
+    for (int j = 0; j < 2; ++j) {
+      for (int i = 0; i < 2; ++i) {
+        const double weight = (i ? fx : 1.0 - fx) * (j ? fy : 1.0 - fy);
+        accum += weight * image.texel(x0 + i, y0 + j, level);
+      }
+    }
+
+    return accum;
+  }
 };
 
 class noise_texture : public texture {
  public:
+  static const int turbulence_depth = 7;
+
   noise_texture() {}
 
-  noise_texture(double scale) : m_scale(scale) {}
+  noise_texture(double scale, uint32_t seed = perlin::default_seed)
+  : m_noise(seed), m_scale(scale) {}
+
+  // Bakes the turbulence over bounds, resolution samples along its longest
+  // side, and looks it up there instead of evaluating it. Points outside
+  // bounds still evaluate it.
+  noise_texture(
+    double scale, const aabb& bounds, int resolution,
+    uint32_t seed = perlin::default_seed)
+  : m_noise(seed)
+  , m_scale(scale)
+  , m_volume(std::make_shared<noise_volume>(
+      m_noise, turbulence_depth, bounds, resolution)) {}
 
   color value(double u, double v, const point3& p) const override {
-    return color(0.5, 0.5, 0.5) 
-      * (1.0 + sin(m_scale * p.z() + 10 * m_noise.turb(p, 7.0)));
+    const double turbulence = m_volume && m_volume->contains(p)
+      ? m_volume->value(p)
+      : m_noise.turb(p, turbulence_depth);
+    return color(0.5, 0.5, 0.5)
+      * (1.0 + sin(m_scale * p.z() + 10 * turbulence));
   }
 
+  double scale() const { return m_scale; }
+  uint32_t seed() const { return m_noise.seed(); }
+
  private:
   perlin m_noise;
   double m_scale;
+  std::shared_ptr<noise_volume> m_volume;
 };
 
+const int noise_texture::turbulence_depth;
+
 #endif  // _TEXTURE_H_
@@ -0,0 +1,414 @@
+#ifndef _TEXTURE_CACHE_H_
+#define _TEXTURE_CACHE_H_
+
+#include "rtweekend.h"
+#include "rtw_image.h"
+
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class texture_cache;
+
+// An image whose pixels are owned by the texture cache. It is decoded on
+// the first lookup, not when created, and its tiles are then kept in a
+// temporary tile store, from which any evicted tile is read back on its
+// own.
+class cached_image {
+ public:
+  cached_image(texture_cache& cache, const std::string& filename)
+  : m_cache(cache), m_filename(filename) {}
+
+  ~cached_image() {
+    if (m_store) {
+      std::fclose(m_store);
+    }
+  }
+
+  cached_image(const cached_image&) = delete;
+  cached_image& operator=(const cached_image&) = delete;
+
+  const std::string& filename() const { return m_filename; }
+
+ private:
+  friend class texture_cache;
+
+  struct level {
+    int  width;
+    int  height;
+    int  tiles_x;
+    // Position of the level's first tile in the tile store, in tiles.
+    long first_tile;
+    std::vector<std::unique_ptr<unsigned char[]>> tiles;
+    std::unique_ptr<std::atomic<unsigned char>[]> referenced;
+  };
+
+  texture_cache&          m_cache;
+  std::string             m_filename;
+  std::atomic<bool>       m_loaded{false};
+  std::atomic<bool>       m_failed{false};
+  rtw_image::pixel_format m_format = rtw_image::pixel_format::srgb8;
+  int                     m_pixel_bytes = 0;
+  int                     m_tile_bytes = 0;
+  std::vector<level>      m_levels;
+  // Null if no temporary file could be made, in which case every tile
+  // stays resident.
+  std::FILE*              m_store = nullptr;
+  // A tile is only read, loaded or evicted with its shard locked.
+  static const int        shard_count = 64;
+  std::mutex              m_shards[shard_count];
+
+  std::mutex& shard(int level, int tile) {
+    return m_shards[(m_levels[level].first_tile + tile) % shard_count];
+  }
+};
+
+const int cached_image::shard_count;
+
+// Process-wide cache of image textures, keyed by file name so every texture
+// referencing the same file shares one copy. Resident pixels are kept under
+// a memory budget by evicting single tiles with the clock algorithm, and a
+// lookup that finds its tile evicted reads just that tile back from the
+// image's tile store. Only the first decode of a file holds all of it in
+// memory at once.
+//
+// Lookups only lock the shard of the image's tiles holding the tile they
+// read, so they run in parallel as long as their tiles are resident. The
+// cache-wide lock is only taken to decode, load or evict, always before
+// any shard.
+class texture_cache {
+ public:
+  static const size_t default_budget = size_t(1) << 30;
+
+  struct stats {
+    size_t images;
+    size_t hits;
+    size_t misses;
+    size_t loads;
+    size_t evictions;
+    size_t resident_bytes;
+    size_t peak_bytes;
+  };
+
+  // Reads the texels of one filtered lookup, keeping the tile it last read
+  // resident until it moves on to another. Loads the image if this is its
+  // first use.
+  class reader {
+   public:
+    explicit reader(cached_image& image) : m_image(image) {
+      if (!image.m_loaded.load(std::memory_order_acquire)
+          && !image.m_failed.load(std::memory_order_acquire)) {
+        image.m_cache.decode(image);
+      }
+    }
+
+    ~reader() {
+      if (m_hits > 0) {
+        m_image.m_cache.m_hits.fetch_add(m_hits, std::memory_order_relaxed);
+      }
+      if (m_misses > 0) {
+        m_image.m_cache.m_misses.fetch_add(m_misses,
+                                           std::memory_order_relaxed);
+      }
+    }
+
+    bool valid() const {
+      return m_image.m_loaded.load(std::memory_order_acquire);
+    }
+
+    int level_count() const {
+      return static_cast<int>(m_image.m_levels.size());
+    }
+
+    int width(int level) const { return m_image.m_levels[level].width; }
+    int height(int level) const { return m_image.m_levels[level].height; }
+
+    // Linear color of the pixel at (x, y) of a level, clamped to the edges.
+    // Consecutive texels from one tile reuse its pointer, which is
+    // the common case for the four texels of a bilinear lookup.
+    color texel(int x, int y, int level) {
+      const cached_image::level& l = m_image.m_levels[level];
+      x = x < 0 ? 0 : (x < l.width ? x : l.width - 1);
+      y = y < 0 ? 0 : (y < l.height ? y : l.height - 1);
+
+      const int tile_size = rtw_image::tile_size;
+      const int tile = (y / tile_size) * l.tiles_x + x / tile_size;
+      if (level != m_level || tile != m_tile) {
+        m_tile_data = fetch(level, tile);
+        m_level = level;
+        m_tile = tile;
+      }
+      if (!m_tile_data) {
+        return color(0.0, 1.0, 1.0);
+      }
+
+      const unsigned char* pixel = m_tile_data
+        + ((y % tile_size) * tile_size + x % tile_size)
+          * m_image.m_pixel_bytes;
+      return rtw_image::decode(m_image.m_format, pixel);
+    }
+
+   private:
+    cached_image&                m_image;
+    std::unique_lock<std::mutex> m_lock;
+    int                          m_level = -1;
+    int                          m_tile = -1;
+    const unsigned char*         m_tile_data = nullptr;
+    size_t                       m_hits = 0;
+    size_t                       m_misses = 0;
+
+    // Resident tile, loaded from the tile store if it was evicted. Its
+    // pointer stays valid while its shard stays locked, until the next
+    // fetch. Null only if the store can no longer be read.
+    const unsigned char* fetch(int level, int tile) {
+      if (m_lock.owns_lock()) {
+        m_lock.unlock();
+      }
+      m_lock = std::unique_lock<std::mutex>(m_image.shard(level, tile));
+
+      cached_image::level& l = m_image.m_levels[level];
+      l.referenced[tile].store(1, std::memory_order_relaxed);
+      if (l.tiles[tile]) {
+        ++m_hits;
+        return l.tiles[tile].get();
+      }
+
+      // Another lookup may evict the tile again before the lock is back.
+      while (!l.tiles[tile]) {
+        ++m_misses;
+        m_lock.unlock();
+        const bool loaded = m_image.m_cache.load_tile(m_image, level, tile);
+        m_lock.lock();
+        if (!loaded) {
+          return nullptr;
+        }
+      }
+      return l.tiles[tile].get();
+    }
+  };
+
+  static texture_cache& global() {
+    static texture_cache cache;
+    return cache;
+  }
+
+  // Handle for the image in filename. Nothing is read from disk until the
+  // first lookup.
+  std::shared_ptr<cached_image> get(const std::string& filename) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto found = m_images.find(filename);
+    if (found != m_images.end()) {
+      return found->second;
+    }
+
+    std::shared_ptr<cached_image> image =
+      std::make_shared<cached_image>(*this, filename);
+    m_images.emplace(filename, image);
+    return image;
+  }
+
+  void set_budget(size_t bytes) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_budget = bytes;
+    evict_to_budget(0);
+  }
+
+  size_t budget() const { return m_budget; }
+
+  stats statistics() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    stats result = m_stats;
+    result.images = m_images.size();
+    result.hits = m_hits.load(std::memory_order_relaxed);
+    result.misses = m_misses.load(std::memory_order_relaxed);
+    return result;
+  }
+
+  // One line of statistics, or nothing if no image was ever requested.
+  void report(std::ostream& out) {
+    const stats s = statistics();
+    if (s.images == 0) {
+      return;
+    }
+    out << "Texture cache: " << s.images << " images, "
+        << s.hits << " hits, " << s.misses << " misses, "
+        << s.loads << " loads, " << s.evictions << " evicted tiles, "
+        << s.peak_bytes / 1024 << " KB peak of "
+        << m_budget / 1024 << " KB budget\n";
+  }
+
+ private:
+  struct tile_ref {
+    cached_image* image;
+    int           level;
+    int           tile;
+  };
+
+  using image_map =
+    std::unordered_map<std::string, std::shared_ptr<cached_image>>;
+
+  std::mutex            m_mutex;
+  image_map             m_images;
+  std::vector<tile_ref> m_resident;
+  size_t                m_hand = 0;
+  size_t                m_budget = default_budget;
+  stats                 m_stats = {};
+  std::atomic<size_t>   m_hits{0};
+  std::atomic<size_t>   m_misses{0};
+
+  // Decodes the file, writes every tile to a new tile store and keeps as
+  // many resident as fit in the budget. A file that cannot be read is not
+  // retried.
+  void decode(cached_image& image) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (image.m_loaded.load(std::memory_order_relaxed)
+        || image.m_failed.load(std::memory_order_relaxed)) {
+      return;
+    }
+
+    const rtw_image decoded(image.m_filename.c_str());
+    ++m_stats.loads;
+
+    if (decoded.height() <= 0) {
+      image.m_failed.store(true, std::memory_order_release);
+      return;
+    }
+
+    image.m_format = decoded.pixel_type();
+    image.m_pixel_bytes = decoded.pixel_bytes();
+    image.m_tile_bytes = decoded.tile_bytes();
+    image.m_store = std::tmpfile();
+    if (!image.m_store) {
+      std::cerr << "WARNING: No tile store for '" << image.m_filename
+        << "', keeping all of it resident\n";
+    }
+
+    image.m_levels.resize(decoded.level_count());
+    long first_tile = 0;
+    for (int i = 0; i < decoded.level_count(); ++i) {
+      cached_image::level& l = image.m_levels[i];
+      const int count = decoded.tile_count(i);
+      l.width = decoded.width(i);
+      l.height = decoded.height(i);
+      l.tiles_x = decoded.tiles_x(i);
+      l.first_tile = first_tile;
+      l.tiles.resize(count);
+      l.referenced.reset(new std::atomic<unsigned char>[count]);
+      first_tile += count;
+
+      for (int t = 0; t < count; ++t) {
+        l.referenced[t].store(0, std::memory_order_relaxed);
+        if (image.m_store
+            && std::fwrite(decoded.tile_data(i, t), image.m_tile_bytes, 1,
+                           image.m_store) != 1) {
+          std::fclose(image.m_store);
+          image.m_store = nullptr;
+          std::cerr << "WARNING: Could not write the tile store for '"
+            << image.m_filename << "', keeping all of it resident\n";
+        }
+      }
+    }
+
+    // Without a store every tile has to stay, and is never evicted.
+    for (int i = 0; i < decoded.level_count(); ++i) {
+      cached_image::level& l = image.m_levels[i];
+      for (int t = 0; t < decoded.tile_count(i); ++t) {
+        if (image.m_store && m_stats.resident_bytes + image.m_tile_bytes
+                               > m_budget) {
+          break;
+        }
+        l.tiles[t].reset(new unsigned char[image.m_tile_bytes]);
+        std::copy(decoded.tile_data(i, t),
+                  decoded.tile_data(i, t) + image.m_tile_bytes,
+                  l.tiles[t].get());
+        add_resident(image, i, t);
+      }
+    }
+
+    image.m_loaded.store(true, std::memory_order_release);
+  }
+
+  // Reads one evicted tile back from the image's tile store, first
+  // evicting others to make room for it. Returns false if the store
+  // cannot be read.
+  bool load_tile(cached_image& image, int level, int tile) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    cached_image::level& l = image.m_levels[level];
+    {
+      std::lock_guard<std::mutex> reading(image.shard(level, tile));
+      if (l.tiles[tile]) {
+        return true;
+      }
+    }
+    if (!image.m_store) {
+      return false;
+    }
+
+    evict_to_budget(image.m_tile_bytes);
+
+    std::unique_ptr<unsigned char[]> data(
+      new unsigned char[image.m_tile_bytes]);
+    const long offset = (l.first_tile + tile) * image.m_tile_bytes;
+    if (std::fseek(image.m_store, offset, SEEK_SET) != 0
+        || std::fread(data.get(), image.m_tile_bytes, 1, image.m_store)
+             != 1) {
+      return false;
+    }
+
+    {
+      std::lock_guard<std::mutex> writing(image.shard(level, tile));
+      l.tiles[tile] = std::move(data);
+    }
+    add_resident(image, level, tile);
+    return true;
+  }
+
+  // Called with the cache locked.
+  void add_resident(cached_image& image, int level, int tile) {
+    if (image.m_store) {
+      m_resident.push_back({ &image, level, tile });
+    }
+    m_stats.resident_bytes += image.m_tile_bytes;
+    if (m_stats.resident_bytes > m_stats.peak_bytes) {
+      m_stats.peak_bytes = m_stats.resident_bytes;
+    }
+  }
+
+  // Evicts tiles until incoming more bytes fit in the budget. Called with
+  // the cache locked.
+  void evict_to_budget(size_t incoming) {
+    while (m_stats.resident_bytes + incoming > m_budget
+           && !m_resident.empty()) {
+      if (m_hand >= m_resident.size()) {
+        m_hand = 0;
+      }
+
+      const tile_ref entry = m_resident[m_hand];
+      cached_image::level& l = entry.image->m_levels[entry.level];
+
+      if (l.referenced[entry.tile].exchange(0, std::memory_order_relaxed)) {
+        ++m_hand;
+      } else {
+        {
+          std::lock_guard<std::mutex> writing(
+            entry.image->shard(entry.level, entry.tile));
+          l.tiles[entry.tile].reset();
+        }
+        m_stats.resident_bytes -= entry.image->m_tile_bytes;
+        ++m_stats.evictions;
+        m_resident[m_hand] = m_resident.back();
+        m_resident.pop_back();
+      }
+    }
+  }
+};
+
+const size_t texture_cache::default_budget;
+
+#endif  // _TEXTURE_CACHE_H_
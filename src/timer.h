@@ -0,0 +1,23 @@
+#ifndef _TIMER_H_
+#define _TIMER_H_
+
+#include <chrono>
+
+// Wall-clock stopwatch used for the renderer's timing reports.
+class timer {
+ public:
+  timer() : m_start(clock::now()) {}
+
+  void reset() { m_start = clock::now(); }
+
+  double seconds() const {
+    return std::chrono::duration<double>(clock::now() - m_start).count();
+  }
+
+ private:
+  using clock = std::chrono::steady_clock;
+
+  clock::time_point m_start;
+};
+
+#endif  // _TIMER_H_
@@ -0,0 +1,41 @@
+#ifndef _TRIANGLE_H_
+#define _TRIANGLE_H_
+
+#include "rtweekend.h"
+#include "hittable.h"
+#include "primitive.h"
+
+// Triangle with corners q, q + u and q + v. The hit's (u, v) are the
+// barycentric coordinates along the two edges.
+class triangle : public hittable {
+ public:
+  triangle(
+    const point3& q,
+    const vec3& u,
+    const vec3& v,
+    std::shared_ptr<material> mat)
+  : m_data(make_quad_data(q, u, v)), m_mat(mat) {
+    m_bbox = triangle_bounds(m_data);
+  }
+
+  bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+    if (!hit_triangle(m_data, r, ray_t, rec)) {
+      return false;
+    }
+
+    rec.mat = m_mat;
+    return true;
+  }
+
+  aabb bounding_box() const override { return m_bbox; }
+
+  const quad_data& data() const { return m_data; }
+  const std::shared_ptr<material>& mat() const { return m_mat; }
+
+ private:
+  quad_data m_data;
+  std::shared_ptr<material> m_mat;
+  aabb m_bbox;
+};
+
+#endif  // _TRIANGLE_H_
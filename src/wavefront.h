@@ -0,0 +1,506 @@
+#ifndef _WAVEFRONT_H_
+#define _WAVEFRONT_H_
+
+#include "rtweekend.h"
+#include "camera.h"
+#include "hittable.h"
+#include "material.h"
+#include "timer.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+// Structure-of-arrays storage for the paths of one wave. Every stage of the
+// wavefront renderer walks these arrays front to back.
+class ray_stream {
+ public:
+  std::vector<double> org_x, org_y, org_z;
+  std::vector<double> dir_x, dir_y, dir_z;
+  std::vector<double> time;
+  std::vector<double> cone_width, cone_spread;
+  std::vector<double> beta_r, beta_g, beta_b;
+  std::vector<int>    pixel;
+
+  size_t size() const { return pixel.size(); }
+
+  void resize(size_t n) {
+    org_x.resize(n); org_y.resize(n); org_z.resize(n);
+    dir_x.resize(n); dir_y.resize(n); dir_z.resize(n);
+    time.resize(n);
+    cone_width.resize(n); cone_spread.resize(n);
+    beta_r.resize(n); beta_g.resize(n); beta_b.resize(n);
+    pixel.resize(n);
+  }
+
+  ray get_ray(size_t i) const {
+    ray r(
+      point3(org_x[i], org_y[i], org_z[i]),
+      vec3(dir_x[i], dir_y[i], dir_z[i]),
+      time[i]);
+    r.set_cone(cone_width[i], cone_spread[i]);
+    return r;
+  }
+
+  void set_ray(size_t i, const ray& r) {
+    const point3& o = r.origin();
+    const vec3& d = r.direction();
+    org_x[i] = o.x(); org_y[i] = o.y(); org_z[i] = o.z();
+    dir_x[i] = d.x(); dir_y[i] = d.y(); dir_z[i] = d.z();
+    time[i] = r.time();
+    cone_width[i] = r.cone_width();
+    cone_spread[i] = r.cone_spread();
+  }
+
+  color beta(size_t i) const { return color(beta_r[i], beta_g[i], beta_b[i]); }
+
+  void set_beta(size_t i, const color& c) {
+    beta_r[i] = c.x(); beta_g[i] = c.y(); beta_b[i] = c.z();
+  }
+
+  // Copies the entries of src listed in order, used to reorder the stream.
+  void gather(const ray_stream& src, const std::vector<size_t>& order) {
+    resize(order.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+      const size_t j = order[i];
+      org_x[i] = src.org_x[j];
+      org_y[i] = src.org_y[j];
+      org_z[i] = src.org_z[j];
+      dir_x[i] = src.dir_x[j];
+      dir_y[i] = src.dir_y[j];
+      dir_z[i] = src.dir_z[j];
+      time[i] = src.time[j];
+      cone_width[i] = src.cone_width[j];
+      cone_spread[i] = src.cone_spread[j];
+      beta_r[i] = src.beta_r[j];
+      beta_g[i] = src.beta_g[j];
+      beta_b[i] = src.beta_b[j];
+      pixel[i] = src.pixel[j];
+    }
+  }
+
+  // Moves entry src to dst, used by stream compaction.
+  void move(size_t dst, size_t src) {
+    org_x[dst] = org_x[src]; org_y[dst] = org_y[src]; org_z[dst] = org_z[src];
+    dir_x[dst] = dir_x[src]; dir_y[dst] = dir_y[src]; dir_z[dst] = dir_z[src];
+    time[dst] = time[src];
+    cone_width[dst] = cone_width[src];
+    cone_spread[dst] = cone_spread[src];
+    beta_r[dst] = beta_r[src];
+    beta_g[dst] = beta_g[src];
+    beta_b[dst] = beta_b[src];
+    pixel[dst] = pixel[src];
+  }
+};
+
+// Renders the same image as camera::render, but breadth first: a large wave
+// of paths is advanced one bounce at a time through separate stages
+// (generate, extend, shade, compact), each a tight loop over the ray
+// stream, instead of following every path recursively to its end.
+class wavefront_renderer {
+ public:
+  size_t wave_size        = 1 << 16;
+  // Groups hits by material type and texture before shading, so every
+  // material kernel runs over a contiguous batch.
+  bool   sort_by_material = false;
+  // Reorders secondary rays by direction octant and the Morton code of
+  // their quantized origin before each extend, so rays that traverse the
+  // same BVH nodes are traced back to back.
+  bool   sort_rays        = false;
+
+  explicit wavefront_renderer(camera& cam) : m_cam(cam) {}
+
+  // Returns false if the image cannot be written.
+  bool render(const hittable& world) {
+    m_cam.initialize();
+
+    const int width = m_cam.image_width;
+    const int height = m_cam.image_height;
+    const size_t total_paths =
+      static_cast<size_t>(width) * height * m_cam.samples_per_pixel;
+
+    m_radiance.assign(static_cast<size_t>(width) * height, color());
+    m_scene_bounds = world.bounding_box();
+
+    for (size_t first = 0; first < total_paths; first += wave_size) {
+      std::clog << "\rPaths remaining: " << (total_paths - first)
+        << " " << std::flush;
+
+      const size_t count = std::min(wave_size, total_paths - first);
+      generate(first, count);
+
+      for (int depth = 0; depth < m_cam.max_depth && m_stream.size() > 0;
+           ++depth) {
+        timer stage;
+        if (sort_rays && depth > 0) {
+          reorder_rays();
+        }
+        m_reorder_seconds += stage.seconds();
+
+        stage.reset();
+        extend(world);
+        m_extend_seconds += stage.seconds();
+
+        stage.reset();
+        gather_hits();
+        m_sort_seconds += stage.seconds();
+
+        stage.reset();
+        shade();
+        m_shade_seconds += stage.seconds();
+
+        stage.reset();
+        compact();
+        m_compact_seconds += stage.seconds();
+      }
+    }
+
+    std::clog << "\rDone.                    \n";
+    report();
+
+    framebuffer image(width, height);
+    for (int y = 0; y < height; ++y) {
+      for (int x = 0; x < width; ++x) {
+        image.at(x, y) = m_radiance[static_cast<size_t>(y) * width + x]
+          * m_cam.pixel_samples_scale;
+      }
+    }
+    return image.save(m_cam.output_path, m_cam.output_format);
+  }
+
+ private:
+  camera&                 m_cam;
+  ray_stream              m_stream;
+  std::vector<hit_record> m_hits;
+  std::vector<char>       m_hit;
+  std::vector<char>       m_alive;
+  std::vector<color>      m_radiance;
+  std::vector<size_t>     m_order;
+  std::vector<uint64_t>   m_ray_keys;
+  std::vector<uint64_t>   m_key_scratch;
+  ray_stream              m_scratch;
+
+  aabb   m_scene_bounds;
+  double m_reorder_seconds = 0.0;
+  double m_extend_seconds  = 0.0;
+  double m_sort_seconds    = 0.0;
+  double m_shade_seconds   = 0.0;
+  double m_compact_seconds = 0.0;
+
+  // Hits are grouped with a counting sort over shading buckets, one bucket
+  // per distinct material, ordered by (type, texture, material).
+  struct shading_bucket {
+    material_type   type;
+    const texture*  tex;
+    const material* mat;
+    size_t          begin;
+    size_t          end;
+
+    bool operator<(const shading_bucket& other) const {
+      if (type != other.type) return type < other.type;
+      if (tex != other.tex) {
+        return std::less<const texture*>()(tex, other.tex);
+      }
+      return std::less<const material*>()(mat, other.mat);
+    }
+  };
+  std::vector<shading_bucket>                 m_buckets;
+  std::unordered_map<const material*, size_t> m_bucket_of;
+  std::vector<size_t>                         m_hit_bucket;
+
+  // Path index p covers sample p % spp of pixel p / spp, in scanline order.
+  void generate(size_t first, size_t count) {
+    m_stream.resize(count);
+    const size_t spp = static_cast<size_t>(m_cam.samples_per_pixel);
+
+    for (size_t i = 0; i < count; ++i) {
+      const size_t pixel = (first + i) / spp;
+      const int x = static_cast<int>(pixel % m_cam.image_width);
+      const int y = static_cast<int>(pixel / m_cam.image_width);
+
+      m_stream.set_ray(i, m_cam.get_ray(x, y));
+      m_stream.set_beta(i, color(1.0, 1.0, 1.0));
+      m_stream.pixel[i] = static_cast<int>(pixel);
+    }
+  }
+
+  // Spreads the low 10 bits of v so that there are two zero bits between
+  // each of them.
+  static uint32_t expand_bits(uint32_t v) {
+    v &= 0x3ffu;
+    v = (v | (v << 16)) & 0x030000ffu;
+    v = (v | (v << 8)) & 0x0300f00fu;
+    v = (v | (v << 4)) & 0x030c30c3u;
+    v = (v | (v << 2)) & 0x09249249u;
+    return v;
+  }
+
+  uint32_t quantize(double value, const interval& range) const {
+    const double extent = range.size();
+    if (!(extent > 0.0) || std::isinf(extent)) {
+      return 0u;
+    }
+    const double unit = interval(0.0, 1.0).clamp((value - range.min) / extent);
+    return static_cast<uint32_t>(unit * 1023.0);
+  }
+
+  // The key holds the direction octant in bits 61..63 and a 29 bit Morton
+  // code of the origin (the 30 bit one without its last z bit) in bits
+  // 32..60; the ray index rides in the low word.
+  void reorder_rays() {
+    const size_t n = m_stream.size();
+    m_ray_keys.resize(n);
+
+    for (size_t i = 0; i < n; ++i) {
+      const uint64_t octant =
+          (m_stream.dir_x[i] < 0.0 ? 1u : 0u)
+        | (m_stream.dir_y[i] < 0.0 ? 2u : 0u)
+        | (m_stream.dir_z[i] < 0.0 ? 4u : 0u);
+      const uint64_t morton =
+          (expand_bits(quantize(m_stream.org_x[i], m_scene_bounds.x)) << 2)
+        | (expand_bits(quantize(m_stream.org_y[i], m_scene_bounds.y)) << 1)
+        |  expand_bits(quantize(m_stream.org_z[i], m_scene_bounds.z));
+      const uint64_t key = (octant << 29) | (morton >> 1);
+      m_ray_keys[i] = (key << 32) | static_cast<uint64_t>(i);
+    }
+
+    radix_sort_keys();
+
+    m_order.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+      m_order[i] = static_cast<size_t>(m_ray_keys[i] & 0xffffffffu);
+    }
+    m_scratch.gather(m_stream, m_order);
+    std::swap(m_stream, m_scratch);
+  }
+
+  // LSD radix sort on the 32 key bits above the ray index, four passes of
+  // eight bits each.
+  void radix_sort_keys() {
+    const int radix_bits = 8;
+    const size_t buckets = size_t(1) << radix_bits;
+    std::vector<size_t> counts(buckets);
+    m_key_scratch.resize(m_ray_keys.size());
+
+    for (int pass = 0; pass < 4; ++pass) {
+      const int shift = 32 + pass * radix_bits;
+      std::fill(counts.begin(), counts.end(), 0);
+      for (uint64_t key : m_ray_keys) {
+        ++counts[(key >> shift) & (buckets - 1)];
+      }
+
+      size_t offset = 0;
+      for (size_t& count : counts) {
+        const size_t c = count;
+        count = offset;
+        offset += c;
+      }
+
+      for (uint64_t key : m_ray_keys) {
+        m_key_scratch[counts[(key >> shift) & (buckets - 1)]++] = key;
+      }
+      std::swap(m_ray_keys, m_key_scratch);
+    }
+  }
+
+  void extend(const hittable& world) {
+    const size_t n = m_stream.size();
+    m_hits.resize(n);
+    m_hit.resize(n);
+
+    for (size_t i = 0; i < n; ++i) {
+      m_hit[i] = world.hit(
+        m_stream.get_ray(i), interval(0.001, infinity), m_hits[i]);
+    }
+  }
+
+  // Resolves misses against the background and collects the indices of the
+  // rays that hit something into m_order, grouped by material type, texture
+  // and material when sorting is enabled.
+  void gather_hits() {
+    const size_t n = m_stream.size();
+    m_alive.resize(n);
+    m_order.clear();
+
+    if (!sort_by_material) {
+      for (size_t i = 0; i < n; ++i) {
+        if (resolve_miss(i)) {
+          m_order.push_back(i);
+        }
+      }
+      return;
+    }
+
+    m_buckets.clear();
+    m_bucket_of.clear();
+    m_hit_bucket.resize(n);
+
+    const material* last_mat = nullptr;
+    size_t last_bucket = 0;
+    for (size_t i = 0; i < n; ++i) {
+      if (!resolve_miss(i)) {
+        continue;
+      }
+
+      const material* mat = m_hits[i].mat.get();
+      if (mat != last_mat) {
+        auto found = m_bucket_of.find(mat);
+        if (found == m_bucket_of.end()) {
+          found = m_bucket_of.emplace(mat, m_buckets.size()).first;
+          m_buckets.push_back(
+            { mat->type(), mat->shading_texture(), mat, 0, 0 });
+        }
+        last_mat = mat;
+        last_bucket = found->second;
+      }
+      m_hit_bucket[i] = last_bucket;
+      ++m_buckets[last_bucket].end;
+    }
+
+    // Lay the buckets out in key order, then scatter the hit indices.
+    std::vector<size_t> slot(m_buckets.size());
+    std::vector<size_t> rank(m_buckets.size());
+    for (size_t b = 0; b < rank.size(); ++b) {
+      rank[b] = b;
+    }
+    std::sort(rank.begin(), rank.end(), [this](size_t a, size_t b) {
+      return m_buckets[a] < m_buckets[b];
+    });
+
+    size_t offset = 0;
+    for (size_t b : rank) {
+      const size_t count = m_buckets[b].end;
+      m_buckets[b].begin = offset;
+      m_buckets[b].end = offset + count;
+      slot[b] = offset;
+      offset += count;
+    }
+
+    m_order.resize(offset);
+    for (size_t i = 0; i < n; ++i) {
+      if (m_hit[i]) {
+        m_order[slot[m_hit_bucket[i]]++] = i;
+      }
+    }
+
+    std::sort(m_buckets.begin(), m_buckets.end());
+  }
+
+  bool resolve_miss(size_t i) {
+    if (m_hit[i]) {
+      return true;
+    }
+    m_radiance[m_stream.pixel[i]] += m_stream.beta(i) * m_cam.background;
+    m_alive[i] = false;
+    return false;
+  }
+
+  // Adds emission to the pixels and replaces every ray that scatters by its
+  // continuation, weighting the path throughput.
+  void shade() {
+    if (!sort_by_material) {
+      shade_batch_generic(0, m_order.size());
+      return;
+    }
+
+    for (const shading_bucket& bucket : m_buckets) {
+      switch (bucket.type) {
+        case material_type::lambertian:
+          shade_batch<lambertian>(bucket.begin, bucket.end);
+          break;
+        case material_type::metal:
+          shade_batch<metal>(bucket.begin, bucket.end);
+          break;
+        case material_type::dielectric:
+          shade_batch<dielectric>(bucket.begin, bucket.end);
+          break;
+        case material_type::diffuse_light:
+          shade_batch<diffuse_light>(bucket.begin, bucket.end);
+          break;
+        case material_type::isotropic:
+          shade_batch<isotropic>(bucket.begin, bucket.end);
+          break;
+        default:
+          shade_batch_generic(bucket.begin, bucket.end);
+          break;
+      }
+    }
+  }
+
+  // Kernel for one concrete material type, calls are resolved statically.
+  template <typename Material>
+  void shade_batch(size_t begin, size_t end) {
+    for (size_t k = begin; k < end; ++k) {
+      const size_t i = m_order[k];
+      const hit_record& rec = m_hits[i];
+      const Material& mat = static_cast<const Material&>(*rec.mat);
+
+      ray scattered;
+      color attenuation;
+      const color emission = mat.Material::emitted(rec.u, rec.v, rec.p);
+      const bool scatters = mat.Material::scatter(
+        m_stream.get_ray(i), rec, attenuation, scattered);
+      finish_hit(i, emission, scatters, attenuation, scattered);
+    }
+  }
+
+  void shade_batch_generic(size_t begin, size_t end) {
+    for (size_t k = begin; k < end; ++k) {
+      const size_t i = m_order[k];
+      const hit_record& rec = m_hits[i];
+
+      ray scattered;
+      color attenuation;
+      const color emission = rec.mat->emitted(rec.u, rec.v, rec.p);
+      const bool scatters = rec.mat->scatter(
+        m_stream.get_ray(i), rec, attenuation, scattered);
+      finish_hit(i, emission, scatters, attenuation, scattered);
+    }
+  }
+
+  void finish_hit(
+    size_t i,
+    const color& emission,
+    bool scatters,
+    const color& attenuation,
+    const ray& scattered) {
+    const color beta = m_stream.beta(i);
+    m_radiance[m_stream.pixel[i]] += beta * emission;
+
+    m_alive[i] = scatters;
+    if (scatters) {
+      m_stream.set_ray(i, scattered);
+      m_stream.set_beta(i, beta * attenuation);
+    }
+  }
+
+  // Packs the surviving paths to the front of the stream.
+  void compact() {
+    const size_t n = m_stream.size();
+    size_t live = 0;
+    for (size_t i = 0; i < n; ++i) {
+      if (m_alive[i]) {
+        if (live != i) {
+          m_stream.move(live, i);
+        }
+        ++live;
+      }
+    }
+    m_stream.resize(live);
+  }
+
+  void report() const {
+    const double total = m_reorder_seconds + m_extend_seconds
+      + m_sort_seconds + m_shade_seconds + m_compact_seconds;
+    std::clog << "Wavefront stages (" << total << " s):"
+      << " reorder " << m_reorder_seconds << " s,"
+      << " extend " << m_extend_seconds << " s,"
+      << (sort_by_material ? " sort " : " gather ") << m_sort_seconds << " s,"
+      << " shade " << m_shade_seconds << " s,"
+      << " compact " << m_compact_seconds << " s\n";
+  }
+};
+
+#endif  // _WAVEFRONT_H_